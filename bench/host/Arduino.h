@@ -0,0 +1,104 @@
+// Host stand-in for the parts of the Arduino core the library uses. Time is
+// real (steady clock); delay() does not sleep, so begin() and transport
+// pacing cost nothing on the host.
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+class String {
+   public:
+    String(const char* s = "") : s_(s ? s : "") {}
+    String(const std::string& s) : s_(s) {}
+    String(int v) : s_(std::to_string(v)) {}
+    String(unsigned int v) : s_(std::to_string(v)) {}
+    String(long v) : s_(std::to_string(v)) {}
+    String(unsigned long v) : s_(std::to_string(v)) {}
+
+    const char* c_str() const { return s_.c_str(); }
+    unsigned int length() const { return (unsigned int)s_.size(); }
+    bool reserve(unsigned int size) {
+        s_.reserve(size);
+        return true;
+    }
+    bool concat(const char* s) {
+        s_ += s;
+        return true;
+    }
+    bool concat(const char* s, unsigned int n) {
+        s_.append(s, n);
+        return true;
+    }
+    bool concat(char c) {
+        s_ += c;
+        return true;
+    }
+    char operator[](unsigned int i) const { return s_[i]; }
+
+    String& operator+=(const String& s) {
+        s_ += s.s_;
+        return *this;
+    }
+    String& operator+=(const char* s) {
+        s_ += s;
+        return *this;
+    }
+    String& operator+=(char c) {
+        s_ += c;
+        return *this;
+    }
+    bool operator<(const String& o) const { return s_ < o.s_; }
+    bool operator==(const String& o) const { return s_ == o.s_; }
+    bool operator==(const char* o) const { return s_ == o; }
+    bool operator!=(const String& o) const { return s_ != o.s_; }
+
+   private:
+    std::string s_;
+};
+
+inline String operator+(const String& a, const String& b) {
+    String r(a);
+    r += b;
+    return r;
+}
+inline String operator+(const String& a, const char* b) {
+    String r(a);
+    r += b;
+    return r;
+}
+inline String operator+(const char* a, const String& b) {
+    String r(a);
+    r += b;
+    return r;
+}
+
+// Output is dropped unless MCP_HOST_VERBOSE is set: the server logs every
+// registration and message, which would dominate benchmark time.
+class HardwareSerial {
+   public:
+    void begin(unsigned long) {}
+    size_t print(const char* s);
+    size_t println(const char* s = "");
+    size_t println(const String& s) { return println(s.c_str()); }
+    int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+extern HardwareSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+
+// Cycle counter backed by the monotonic clock in nanoseconds, reported as a
+// 1000 MHz CPU so cycles convert to time like on the device.
+class EspClass {
+   public:
+    uint32_t getCycleCount();
+    uint32_t getCpuFreqMHz() { return 1000; }
+    uint32_t getFreeHeap() { return 0; }
+    void restart() { abort(); }
+};
+extern EspClass ESP;
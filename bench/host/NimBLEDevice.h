@@ -0,0 +1,109 @@
+// NimBLE-Arduino stand-in with just the surface McpBle uses. Notifications
+// go to the sink set with hostBleSetNotifySink(); writes are injected by
+// setting a characteristic's value and calling McpBle::_onWrite(). Link
+// requests (connection parameters, data length, PHY, MTU) are recorded in
+// hostBleLink().
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#define ESP_PWR_LVL_P9 7
+
+#define BLE_GAP_LE_PHY_1M_MASK 0x01
+#define BLE_GAP_LE_PHY_2M_MASK 0x02
+#define BLE_GAP_LE_PHY_CODED_MASK 0x04
+#define BLE_GAP_LE_PHY_CODED_ANY 0
+
+struct ble_gap_conn_desc {
+    uint16_t conn_handle;
+};
+
+namespace NIMBLE_PROPERTY {
+enum { READ = 0x02, WRITE = 0x08, WRITE_NR = 0x04, NOTIFY = 0x10 };
+}
+
+class NimBLECharacteristic;
+class NimBLEServer;
+
+class NimBLECharacteristicCallbacks {
+   public:
+    virtual ~NimBLECharacteristicCallbacks() {}
+    virtual void onWrite(NimBLECharacteristic*) {}
+};
+
+class NimBLECharacteristic {
+   public:
+    void setCallbacks(NimBLECharacteristicCallbacks* callbacks) { callbacks_ = callbacks; }
+    void setValue(const uint8_t* data, size_t len) { value_.assign((const char*)data, len); }
+    std::string getValue() { return value_; }
+    void notify(const uint8_t* data, size_t len, bool isNotification = true);
+
+   private:
+    NimBLECharacteristicCallbacks* callbacks_ = nullptr;
+    std::string value_;
+};
+
+class NimBLEService {
+   public:
+    NimBLECharacteristic* createCharacteristic(const char* uuid, uint32_t properties);
+    bool start() { return true; }
+};
+
+class NimBLEServerCallbacks {
+   public:
+    virtual ~NimBLEServerCallbacks() {}
+    virtual void onConnect(NimBLEServer*, ble_gap_conn_desc*) {}
+    virtual void onDisconnect(NimBLEServer*) {}
+    virtual void onMTUChange(uint16_t, ble_gap_conn_desc*) {}
+};
+
+class NimBLEServer {
+   public:
+    void setCallbacks(NimBLEServerCallbacks* callbacks) { callbacks_ = callbacks; }
+    NimBLEService* createService(const char* uuid);
+    void updateConnParams(uint16_t connHandle, uint16_t minInterval, uint16_t maxInterval, uint16_t latency,
+                          uint16_t timeout);
+    void setDataLen(uint16_t connHandle, uint16_t txOctets);
+
+   private:
+    NimBLEServerCallbacks* callbacks_ = nullptr;
+};
+
+class NimBLEAdvertising {
+   public:
+    void addServiceUUID(const char*) {}
+    void setScanResponse(bool) {}
+    bool start() { return true; }
+};
+
+class NimBLEDevice {
+   public:
+    static void init(const std::string&) {}
+    static void setPower(int) {}
+    static NimBLEServer* createServer();
+    static NimBLEAdvertising* getAdvertising();
+    static bool startAdvertising() { return true; }
+    static bool setMTU(uint16_t mtu);
+};
+
+int ble_gap_set_prefered_le_phy(uint16_t connHandle, uint8_t txPhysMask, uint8_t rxPhysMask, uint16_t phyOpts);
+
+struct HostBleLink {
+    uint32_t connParamUpdates;
+    uint16_t minInterval;
+    uint16_t maxInterval;
+    uint16_t latency;
+    uint16_t timeout;
+    uint16_t dataLength;
+    uint8_t txPhys;
+    uint8_t rxPhys;
+    uint16_t preferredMtu;
+};
+HostBleLink& hostBleLink();
+
+// Receives every notification the server sends.
+typedef void (*HostBleNotifySink)(const uint8_t* data, size_t len, void* ctx);
+void hostBleSetNotifySink(HostBleNotifySink sink, void* ctx);
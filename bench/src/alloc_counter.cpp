@@ -0,0 +1,61 @@
+#include "alloc_counter.h"
+
+#include <stdlib.h>
+
+#include <new>
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static AllocCounters s_counters = {0, 0};
+
+void* __wrap_malloc(size_t size) {
+    s_counters.count++;
+    s_counters.bytes += size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    s_counters.count++;
+    s_counters.bytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    s_counters.count++;
+    s_counters.bytes += size;
+    return __real_realloc(ptr, size);
+}
+}
+
+AllocCounters allocCounters() {
+    return s_counters;
+}
+
+void* operator new(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
@@ -0,0 +1,14 @@
+// Heap allocation counting for the host build. malloc/calloc/realloc are
+// wrapped at link time (-Wl,--wrap=...), and operator new/delete are routed
+// through them, so ArduinoJson, std::string and the library are all counted.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct AllocCounters {
+    uint64_t count;  // malloc, calloc and realloc calls
+    uint64_t bytes;  // bytes requested by them
+};
+
+AllocCounters allocCounters();
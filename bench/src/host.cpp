@@ -0,0 +1,216 @@
+// Implementations behind the stand-in headers in ../host.
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include <stdarg.h>
+
+#include <chrono>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+
+size_t HardwareSerial::print(const char* s) {
+#ifdef MCP_HOST_VERBOSE
+    return fputs(s, stderr);
+#else
+    return strlen(s);
+#endif
+}
+
+size_t HardwareSerial::println(const char* s) {
+    size_t n = print(s);
+    return n + print("\n");
+}
+
+int HardwareSerial::printf(const char* fmt, ...) {
+#ifdef MCP_HOST_VERBOSE
+    va_list args;
+    va_start(args, fmt);
+    int n = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return n;
+#else
+    (void)fmt;
+    return 0;
+#endif
+}
+
+static uint64_t nowNs() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned long millis() { return (unsigned long)(nowNs() / 1000000); }
+unsigned long micros() { return (unsigned long)(nowNs() / 1000); }
+void delay(uint32_t) {}
+uint32_t EspClass::getCycleCount() { return (uint32_t)nowNs(); }
+
+// FreeRTOS
+
+struct HostQueue {
+    uint8_t* storage;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    HostQueue* queue = (HostQueue*)calloc(1, sizeof(HostQueue));
+    queue->storage = (uint8_t*)malloc(length * itemSize);
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    if (!queue) return;
+    free(queue->storage);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t) {
+    if (queue->count == queue->length) return pdFALSE;
+    UBaseType_t slot = (queue->head + queue->count) % queue->length;
+    memcpy(queue->storage + slot * queue->itemSize, item, queue->itemSize);
+    queue->count++;
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t) {
+    if (queue->count == queue->length) return pdFALSE;
+    queue->head = (queue->head + queue->length - 1) % queue->length;
+    memcpy(queue->storage + queue->head * queue->itemSize, item, queue->itemSize);
+    queue->count++;
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t) {
+    if (queue->count == 0) return pdFALSE;
+    memcpy(item, queue->storage + queue->head * queue->itemSize, queue->itemSize);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) { return queue->count; }
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) { return queue->length - queue->count; }
+
+struct HostSemaphore {
+    UBaseType_t count;
+    UBaseType_t max;
+};
+
+static SemaphoreHandle_t createSemaphore(UBaseType_t max, UBaseType_t initial) {
+    HostSemaphore* semaphore = (HostSemaphore*)malloc(sizeof(HostSemaphore));
+    semaphore->count = initial;
+    semaphore->max = max;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return createSemaphore(1, 1); }
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) { return createSemaphore(1, 1); }
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return createSemaphore(1, 0); }
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+    return createSemaphore(max, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t) {
+    if (semaphore->count == 0) return pdFALSE;
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    if (semaphore->count == semaphore->max) return pdFALSE;
+    semaphore->count++;
+    return pdTRUE;
+}
+
+// Single-threaded: the owner is always the caller, so nesting always succeeds.
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t) { return pdTRUE; }
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) { free(semaphore); }
+
+struct HostTask {
+    TaskFunction_t fn;
+    void* arg;
+};
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char*, uint32_t, void* arg, UBaseType_t, TaskHandle_t* handle) {
+    HostTask* task = (HostTask*)malloc(sizeof(HostTask));
+    task->fn = fn;
+    task->arg = arg;
+    if (handle) *handle = task;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t) {
+    return xTaskCreate(fn, name, stackDepth, arg, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t task) { free(task); }
+void vTaskDelay(TickType_t) {}
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) { return 0; }
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return nullptr; }
+TickType_t xTaskGetTickCount(void) { return (TickType_t)millis(); }
+
+// NimBLE
+
+static HostBleNotifySink s_notifySink = nullptr;
+static void* s_notifyCtx = nullptr;
+
+void hostBleSetNotifySink(HostBleNotifySink sink, void* ctx) {
+    s_notifySink = sink;
+    s_notifyCtx = ctx;
+}
+
+void NimBLECharacteristic::notify(const uint8_t* data, size_t len, bool) {
+    if (s_notifySink) s_notifySink(data, len, s_notifyCtx);
+}
+
+NimBLECharacteristic* NimBLEService::createCharacteristic(const char*, uint32_t) { return new NimBLECharacteristic(); }
+NimBLEService* NimBLEServer::createService(const char*) { return new NimBLEService(); }
+
+HostBleLink& hostBleLink() {
+    static HostBleLink link = {};
+    return link;
+}
+
+void NimBLEServer::updateConnParams(uint16_t, uint16_t minInterval, uint16_t maxInterval, uint16_t latency,
+                                    uint16_t timeout) {
+    HostBleLink& link = hostBleLink();
+    link.connParamUpdates++;
+    link.minInterval = minInterval;
+    link.maxInterval = maxInterval;
+    link.latency = latency;
+    link.timeout = timeout;
+}
+
+void NimBLEServer::setDataLen(uint16_t, uint16_t txOctets) { hostBleLink().dataLength = txOctets; }
+
+bool NimBLEDevice::setMTU(uint16_t mtu) {
+    hostBleLink().preferredMtu = mtu;
+    return true;
+}
+
+int ble_gap_set_prefered_le_phy(uint16_t, uint8_t txPhysMask, uint8_t rxPhysMask, uint16_t) {
+    hostBleLink().txPhys = txPhysMask;
+    hostBleLink().rxPhys = rxPhysMask;
+    return 0;
+}
+
+NimBLEServer* NimBLEDevice::createServer() {
+    static NimBLEServer server;
+    return &server;
+}
+
+NimBLEAdvertising* NimBLEDevice::getAdvertising() {
+    static NimBLEAdvertising advertising;
+    return &advertising;
+}
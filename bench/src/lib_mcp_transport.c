@@ -0,0 +1,2 @@
+/* Library source compiled into the host build. */
+#include "../../src/mcp_transport.c"
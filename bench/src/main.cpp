@@ -0,0 +1,552 @@
+// Host benchmark for the request path: frames requests exactly like a BLE
+// client, feeds them through McpBle and the transport, runs the server loop
+// and reassembles the notified responses. Reports throughput, heap traffic
+// per request and, from the diagnostics trace, where the time goes.
+#include <ArduinoJson.h>
+#include <BLEMCPServer.h>
+#include <McpBle.h>
+#include <McpSchema.h>
+#include <mcp_transport.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "alloc_counter.h"
+
+namespace {
+
+const size_t kMaxPacket = 512;
+
+// BLE central side of the transport.
+class Client {
+   public:
+    void connect(uint16_t mtu) {
+        hostBleSetNotifySink(&Client::onNotify, this);
+        McpBle::getInstance()._onConnect(NimBLEDevice::createServer(), 1);
+        McpBle::getInstance()._onMtuChange(mtu);
+        size_t payload = (size_t)mtu - 3;
+        maxPacket = payload > kMaxPacket ? kMaxPacket : payload;
+        partial.reserve(16384);
+        response.reserve(16384);
+    }
+
+    // Writes through McpBle like the radio would, or with `direct` straight
+    // into the transport, skipping the BLE stack's copy of the value.
+    void send(const std::string& message, bool direct = false) {
+        uint8_t packet[kMaxPacket];
+        const size_t total = message.size();
+        size_t offset = 0;
+        uint8_t seq = 0;
+        do {
+            size_t header = 1;
+            size_t room = maxPacket - 1;
+            if (offset == 0 && total + 1 <= maxPacket) {
+                packet[0] = 0x00 | seq;
+            } else if (offset == 0) {
+                packet[0] = 0x40 | seq;
+                packet[1] = (uint8_t)(total >> 24);
+                packet[2] = (uint8_t)(total >> 16);
+                packet[3] = (uint8_t)(total >> 8);
+                packet[4] = (uint8_t)total;
+                header = 5;
+                room = maxPacket - 5;
+            } else {
+                packet[0] = (total - offset > room ? 0x80 : 0xC0) | seq;
+            }
+            size_t n = total - offset < room ? total - offset : room;
+            memcpy(packet + header, message.data() + offset, n);
+            offset += n;
+            if (direct) {
+                mcp_transport_receive(packet, header + n);
+            } else {
+                rx.setValue(packet, header + n);
+                McpBle::getInstance()._onWrite(&rx);
+            }
+            seq = (seq + 1) & 0x3F;
+        } while (offset < total);
+    }
+
+    std::string response;  // last complete message
+    uint32_t responses = 0;
+    uint64_t txPackets = 0;
+    uint64_t txBytes = 0;
+
+   private:
+    static void onNotify(const uint8_t* data, size_t len, void* ctx) {
+        Client* self = static_cast<Client*>(ctx);
+        if (!len) return;
+        self->txPackets++;
+        self->txBytes += len;
+        uint8_t type = data[0] & 0xC0;
+        if (type == 0x00) {
+            self->partial.assign((const char*)data + 1, len - 1);
+        } else if (type == 0x40) {
+            if (len < 5) return;
+            self->partial.assign((const char*)data + 5, len - 5);
+            return;
+        } else {
+            self->partial.append((const char*)data + 1, len - 1);
+            if (type == 0x80) return;
+        }
+        self->response.assign(self->partial);
+        self->responses++;
+    }
+
+    NimBLECharacteristic rx;
+    std::string partial;
+    size_t maxPacket = 20;
+};
+
+BLEMCPServer server("mcp-bench", "1.0.0");
+Client client;
+uint32_t nextId = 1;
+
+// Returns its text argument. Both handlers write into the server's result
+// document, as allocation-free handlers do.
+class EchoHandler : public ToolHandler {
+   public:
+    uint32_t calls = 0;
+
+    DynamicJsonDocument call(const DynamicJsonDocument& params) override {
+        return invoke(params.as<JsonVariantConst>());
+    }
+    DynamicJsonDocument invoke(JsonVariantConst arguments) override {
+        DynamicJsonDocument result(JSON_OBJECT_SIZE(1) + 64);
+        invokeInto(arguments, result);
+        return result;
+    }
+    bool invokeInto(JsonVariantConst arguments, DynamicJsonDocument& result) override {
+        calls++;
+        result["text"] = arguments["text"];
+        return true;
+    }
+};
+
+// Ignores its arguments and returns a fixed ~3 KB text, linked rather than
+// copied, so only the response side of a large call is measured.
+char largeText[3072];
+
+class LargeHandler : public ToolHandler {
+   public:
+    DynamicJsonDocument call(const DynamicJsonDocument& params) override {
+        return invoke(params.as<JsonVariantConst>());
+    }
+    DynamicJsonDocument invoke(JsonVariantConst arguments) override {
+        DynamicJsonDocument result(JSON_OBJECT_SIZE(1));
+        invokeInto(arguments, result);
+        return result;
+    }
+    bool invokeInto(JsonVariantConst, DynamicJsonDocument& result) override {
+        result["text"] = (const char*)largeText;
+        return true;
+    }
+};
+
+EchoHandler echoHandler;
+LargeHandler largeHandler;
+
+const ToolDefinition echoTool = {
+    "echo",
+    "Return the text argument",
+    MCP_SCHEMA_OBJECT(MCP_SCHEMA_PROPERTIES(MCP_SCHEMA_PROPERTY("text", MCP_SCHEMA_STRING("Text to return"))),
+                      MCP_SCHEMA_REQUIRED("text")),
+    nullptr,
+    &echoHandler,
+    0,
+    ToolPriority::INTERACTIVE,
+};
+
+const ToolDefinition largeTool = {
+    "large",
+    "Return a large text",
+    MCP_SCHEMA_OBJECT(MCP_SCHEMA_PROPERTIES(MCP_SCHEMA_PROPERTY("data", MCP_SCHEMA_STRING("Payload"))),
+                      MCP_SCHEMA_REQUIRED("data")),
+    nullptr,
+    &largeHandler,
+    0,
+    ToolPriority::INTERACTIVE,
+};
+
+const ToolDefinition cachedTool = {
+    "cached_echo",
+    "Return the text argument, cached",
+    MCP_SCHEMA_OBJECT(MCP_SCHEMA_PROPERTIES(MCP_SCHEMA_PROPERTY("text", MCP_SCHEMA_STRING("Text to return"))),
+                      MCP_SCHEMA_REQUIRED("text")),
+    nullptr,
+    &echoHandler,
+    60000,
+    ToolPriority::INTERACTIVE,
+};
+
+const char* const kFillerSchema = MCP_SCHEMA_OBJECT(MCP_SCHEMA_PROPERTIES(
+    MCP_SCHEMA_PROPERTY("channel", MCP_SCHEMA_INTEGER("Channel number")),
+    MCP_SCHEMA_PROPERTY("mode", MCP_SCHEMA(MCP_SCHEMA_TYPE("string"), MCP_SCHEMA_ENUM("off", "low", "high")))));
+
+// Registered definitions are referenced, not copied, so they live here.
+const size_t kMaxFillers = 50;
+char fillerNames[kMaxFillers][16];
+ToolDefinition fillerTools[kMaxFillers];
+size_t fillerCount = 0;
+
+void addFillers(size_t total) {
+    for (; fillerCount < total; fillerCount++) {
+        snprintf(fillerNames[fillerCount], sizeof(fillerNames[fillerCount]), "filler_%02u", (unsigned)fillerCount);
+        fillerTools[fillerCount] = {fillerNames[fillerCount], "Benchmark filler tool", kFillerSchema, nullptr,
+                                    &echoHandler, 0, ToolPriority::INTERACTIVE};
+        server.RegisterTool(fillerTools[fillerCount]);
+    }
+}
+
+double nowUs() {
+    using namespace std::chrono;
+    return duration<double, std::micro>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Requests are built up front with unique ids so that neither string
+// building nor the replay table skews the timed loop.
+std::vector<std::string> buildRequests(size_t count, const char* method, const char* params) {
+    std::vector<std::string> requests;
+    requests.reserve(count);
+    char head[64];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(head, sizeof(head), "{\"jsonrpc\":\"2.0\",\"id\":%u,\"method\":\"", (unsigned)nextId++);
+        std::string request(head);
+        request += method;
+        request += "\"";
+        if (params) {
+            request += ",\"params\":";
+            request += params;
+        }
+        request += "}";
+        requests.push_back(request);
+    }
+    return requests;
+}
+
+const char* const kStageNames[] = {"reassembly", "queue", "parse", "handler", "serialize", "tx wait", "tx"};
+const size_t kStageGaps = sizeof(kStageNames) / sizeof(kStageNames[0]);
+
+bool decodeBase64(const char* in, std::vector<uint8_t>& out) {
+    static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint32_t bits = 0;
+    int count = 0;
+    for (; *in && *in != '='; in++) {
+        const char* p = strchr(kAlphabet, *in);
+        if (!p) return false;
+        bits = (bits << 6) | (uint32_t)(p - kAlphabet);
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            out.push_back((uint8_t)(bits >> count));
+        }
+    }
+    return true;
+}
+
+// Averages the gaps between consecutive trace stages over the requests of
+// the last scenario that have a complete trace.
+void printStages() {
+    client.send(buildRequests(1, "diagnostics", nullptr)[0]);
+    server.loop();
+    DynamicJsonDocument doc(65536);
+    if (deserializeJson(doc, client.response)) return;
+    const double cyclesPerUs = doc["result"]["cyclesPerUs"] | 1.0;
+    std::vector<uint8_t> data;
+    if (!decodeBase64(doc["result"]["trace"]["data"] | "", data)) return;
+
+    const size_t count = data.size() / sizeof(TraceRecord);
+    const TraceRecord* records = reinterpret_cast<const TraceRecord*>(data.data());
+    double sums[kStageGaps] = {};
+    size_t complete = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].stage != (uint8_t)TraceStage::RX_FIRST || !records[i].request) continue;
+        uint32_t cycles[kStageGaps + 1];
+        uint8_t seen = 0;
+        for (size_t j = i; j < count && seen <= kStageGaps; j++) {
+            if (records[j].request != records[i].request || records[j].stage != seen) continue;
+            cycles[seen++] = records[j].cycles;
+        }
+        if (seen != kStageGaps + 1) continue;
+        for (size_t k = 0; k < kStageGaps; k++) {
+            sums[k] += (double)(uint32_t)(cycles[k + 1] - cycles[k]);
+        }
+        complete++;
+    }
+    if (!complete) return;
+    printf("    stages (us, %u traced):", (unsigned)complete);
+    for (size_t k = 0; k < kStageGaps; k++) {
+        printf(" %s %.2f", kStageNames[k], sums[k] / complete / cyclesPerUs);
+    }
+    printf("\n");
+}
+
+void runScenario(const char* label, const char* method, const char* params, size_t iterations) {
+    const size_t warmup = iterations / 10 + 1;
+    std::vector<std::string> requests = buildRequests(warmup + iterations, method, params);
+    for (size_t i = 0; i < warmup; i++) {
+        client.send(requests[i]);
+        server.loop();
+    }
+
+    const uint32_t responses = client.responses;
+    const uint64_t txBytes = client.txBytes;
+    const AllocCounters before = allocCounters();
+    const double start = nowUs();
+    for (size_t i = warmup; i < requests.size(); i++) {
+        client.send(requests[i]);
+        server.loop();
+    }
+    const double elapsed = nowUs() - start;
+    const AllocCounters after = allocCounters();
+
+    const double n = (double)iterations;
+    printf("%-22s %9.0f req/s %8.2f us/req %7.1f allocs/req %9.1f B/req %8.1f tx B/req", label, n * 1e6 / elapsed,
+           elapsed / n, (after.count - before.count) / n, (after.bytes - before.bytes) / n,
+           (client.txBytes - txBytes) / n);
+    if (client.responses - responses != iterations) {
+        printf("  (%u responses)", (unsigned)(client.responses - responses));
+    }
+    printf("\n");
+    printStages();
+}
+
+// Schema validation cost by schema size, without the request around it.
+void runValidation(const char* label, const char* schemaJson, const char* argumentsJson, size_t iterations) {
+    DynamicJsonDocument schemaDoc(8192);
+    DynamicJsonDocument arguments(4096);
+    deserializeJson(schemaDoc, schemaJson);
+    deserializeJson(arguments, argumentsJson);
+    FlatSchema flat;
+    if (!flat.build(schemaDoc.as<JsonVariantConst>())) {
+        printf("%-22s schema rejected\n", label);
+        return;
+    }
+    SchemaValidator validator;
+    validator.compile(flat);
+
+    SchemaValidator::Error error;
+    bool ok = true;
+    const AllocCounters before = allocCounters();
+    const double start = nowUs();
+    for (size_t i = 0; i < iterations; i++) {
+        ok &= validator.validate(arguments.as<JsonVariantConst>(), error);
+    }
+    const double elapsed = nowUs() - start;
+    const AllocCounters after = allocCounters();
+    printf("%-22s %9.1f ns/call %5u nodes %5u ops %7.2f allocs/call%s\n", label, elapsed * 1000.0 / iterations,
+           (unsigned)flat.size(), (unsigned)validator.size(), (after.count - before.count) / (double)iterations,
+           ok ? "" : "  (invalid)");
+}
+
+#define STR(description) MCP_SCHEMA_STRING(description)
+#define INT(description) MCP_SCHEMA_INTEGER(description)
+
+const char* const kSmallSchema = MCP_SCHEMA_OBJECT(
+    MCP_SCHEMA_PROPERTIES(MCP_SCHEMA_PROPERTY("ssid", STR("Network")), MCP_SCHEMA_PROPERTY("password", STR("Key"))),
+    MCP_SCHEMA_REQUIRED("ssid", "password"));
+const char* const kSmallArgs = "{\"ssid\":\"bench\",\"password\":\"secret\"}";
+
+const char* const kMediumSchema = MCP_SCHEMA_OBJECT(
+    MCP_SCHEMA_PROPERTIES(
+        MCP_SCHEMA_PROPERTY("name", STR("Name")), MCP_SCHEMA_PROPERTY("channel", INT("Channel")),
+        MCP_SCHEMA_PROPERTY("gain", MCP_SCHEMA_NUMBER("Gain")), MCP_SCHEMA_PROPERTY("enabled", MCP_SCHEMA_BOOLEAN("On")),
+        MCP_SCHEMA_PROPERTY("mode", MCP_SCHEMA(MCP_SCHEMA_TYPE("string"), MCP_SCHEMA_ENUM("off", "low", "mid", "high"))),
+        MCP_SCHEMA_PROPERTY("tags", MCP_SCHEMA_ARRAY("Tags", STR("Tag"))),
+        MCP_SCHEMA_PROPERTY("range", MCP_SCHEMA_OBJECT(MCP_SCHEMA_PROPERTIES(MCP_SCHEMA_PROPERTY("min", INT("Min")),
+                                                                             MCP_SCHEMA_PROPERTY("max", INT("Max"))),
+                                                       MCP_SCHEMA_REQUIRED("min", "max")))),
+    MCP_SCHEMA_REQUIRED("name", "channel", "mode"), MCP_SCHEMA_ADDITIONAL_PROPERTIES(false));
+const char* const kMediumArgs =
+    "{\"name\":\"bench\",\"channel\":6,\"gain\":1.5,\"enabled\":true,\"mode\":\"mid\","
+    "\"tags\":[\"a\",\"b\",\"c\",\"d\"],\"range\":{\"min\":1,\"max\":9}}";
+
+#define SENSOR(n)                                                                                             \
+    MCP_SCHEMA_PROPERTY("sensor" #n,                                                                          \
+                        MCP_SCHEMA_OBJECT(MCP_SCHEMA_PROPERTIES(MCP_SCHEMA_PROPERTY("id", INT("Id")),         \
+                                                                MCP_SCHEMA_PROPERTY("label", STR("Label")),   \
+                                                                MCP_SCHEMA_PROPERTY("rate", INT("Rate")),     \
+                                                                MCP_SCHEMA_PROPERTY("unit", STR("Unit"))),    \
+                                          MCP_SCHEMA_REQUIRED("id", "rate")))
+#define SENSOR_ARGS(n) "\"sensor" #n "\":{\"id\":" #n ",\"label\":\"s" #n "\",\"rate\":100,\"unit\":\"C\"}"
+
+const char* const kLargeSchema =
+    MCP_SCHEMA_OBJECT(MCP_SCHEMA_PROPERTIES(SENSOR(1), SENSOR(2), SENSOR(3), SENSOR(4), SENSOR(5), SENSOR(6),
+                                            SENSOR(7), SENSOR(8), SENSOR(9), SENSOR(10), SENSOR(11), SENSOR(12)),
+                      MCP_SCHEMA_REQUIRED("sensor1", "sensor12"));
+const char* const kLargeArgs = "{" SENSOR_ARGS(1) "," SENSOR_ARGS(2) "," SENSOR_ARGS(3) "," SENSOR_ARGS(4) ","
+    SENSOR_ARGS(5) "," SENSOR_ARGS(6) "," SENSOR_ARGS(7) "," SENSOR_ARGS(8) "," SENSOR_ARGS(9) "," SENSOR_ARGS(
+        10) "," SENSOR_ARGS(11) "," SENSOR_ARGS(12) "}";
+
+const char* const kSmallParams = "{\"name\":\"echo\",\"arguments\":{\"text\":\"hello from the bench\"}}";
+const char* const kCachedParams = "{\"name\":\"cached_echo\",\"arguments\":{\"text\":\"hello again\"}}";
+
+#ifdef MCP_BENCH_ALLOC_CHECK
+// Warmed-up tools/call requests must not allocate. Frames go straight into
+// the transport, since NimBLE copies every written value before McpBle
+// sees it. Returns the number of failed scenarios.
+int runAllocCheck(const char* label, const char* params, size_t iterations) {
+    const size_t warmup = 16;
+    std::vector<std::string> requests = buildRequests(warmup + iterations, "tools/call", params);
+    for (size_t i = 0; i < warmup; i++) {
+        client.send(requests[i], true);
+        server.loop();
+    }
+    const uint32_t responses = client.responses;
+    const AllocCounters before = allocCounters();
+    for (size_t i = warmup; i < requests.size(); i++) {
+        client.send(requests[i], true);
+        server.loop();
+    }
+    const AllocCounters after = allocCounters();
+    bool answered = client.responses - responses == iterations && client.response.find("\"result\"") != std::string::npos;
+    bool ok = answered && after.count == before.count;
+    printf("%-22s %s: %llu allocations, %llu bytes over %u calls%s\n", label, ok ? "ok" : "FAIL",
+           (unsigned long long)(after.count - before.count), (unsigned long long)(after.bytes - before.bytes),
+           (unsigned)iterations, answered ? "" : " (missing responses)");
+    return ok ? 0 : 1;
+}
+#endif
+
+#ifdef MCP_BENCH_REPLAY_CHECK
+// A request refused for lack of budget is not stored for replay: resent
+// unchanged once memory is available, it runs and gets a result. A result
+// is replayed, also after the client reconnects and initializes again.
+// Returns the number of failed checks.
+int runReplayCheck() {
+    int failed = 0;
+    auto expect = [&failed](const char* label, bool ok) {
+        printf("%-34s %s\n", label, ok ? "ok" : "FAIL");
+        if (!ok) failed++;
+    };
+    const std::string request = buildRequests(1, "tools/call", kSmallParams)[0];
+
+    server.setMemoryBudget(600);
+    client.send(request);
+    server.loop();
+    expect("refused over budget", client.response.find("\"error\"") != std::string::npos);
+
+    server.setMemoryBudget(32 * 1024);
+    client.send(request);
+    server.loop();
+    const std::string answered = client.response;
+    expect("resend runs the tool", answered.find("\"result\"") != std::string::npos);
+
+    const uint32_t calls = echoHandler.calls;
+    client.send(request);
+    server.loop();
+    expect("result replayed", client.response == answered && echoHandler.calls == calls);
+
+    McpBle::getInstance()._onDisconnect(NimBLEDevice::createServer());
+    server.loop();
+    client.connect(247);
+    client.send(buildRequests(1, "initialize",
+                              "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{},"
+                              "\"clientInfo\":{\"name\":\"bench\",\"version\":\"1\"}}")[0]);
+    server.loop();
+    client.send(request);
+    server.loop();
+    expect("replayed after reconnect", client.response == answered && echoHandler.calls == calls);
+    return failed;
+}
+#endif
+
+#ifdef MCP_BENCH_LINK_CHECK
+// Adaptive link parameters against the recording NimBLE stand-in. Idle time
+// is simulated by polling with timestamps past the timeout. Returns the
+// number of failed checks.
+int runLinkCheck() {
+    McpBle& ble = McpBle::getInstance();
+    const McpBle::LinkConfig& config = ble.getLinkConfig();
+    const HostBleLink& link = hostBleLink();
+    int failed = 0;
+    auto expect = [&failed](const char* label, bool ok) {
+        printf("%-34s %s\n", label, ok ? "ok" : "FAIL");
+        if (!ok) failed++;
+    };
+
+    expect("preferred MTU", link.preferredMtu == config.preferredMtu);
+    expect("data length extension", link.dataLength == 251);
+    expect("2M PHY", link.txPhys == BLE_GAP_LE_PHY_2M_MASK && link.rxPhys == BLE_GAP_LE_PHY_2M_MASK);
+    expect("fast profile on connect",
+           ble.getLinkProfile() == McpLinkPolicy::PROFILE_FAST && link.maxInterval == config.fast.maxInterval);
+
+    const uint32_t updates = link.connParamUpdates;
+    client.send(buildRequests(1, "ping", nullptr)[0]);
+    server.loop();
+    expect("no update while fast", link.connParamUpdates == updates);
+
+    const uint32_t now = millis();
+    uint32_t wait = ble.pollLink(now);
+    expect("idle timer armed", wait > 0 && wait <= config.idleTimeoutMs);
+    ble.pollLink(now + config.idleTimeoutMs);
+    expect("slow profile when idle", ble.getLinkProfile() == McpLinkPolicy::PROFILE_SLOW &&
+                                         link.maxInterval == config.slow.maxInterval &&
+                                         link.latency == config.slow.latency);
+    expect("idle timer stopped", ble.pollLink(now + 2 * config.idleTimeoutMs) == UINT32_MAX);
+
+    client.send(buildRequests(1, "ping", nullptr)[0]);
+    server.loop();
+    expect("fast profile on traffic", ble.getLinkProfile() == McpLinkPolicy::PROFILE_FAST &&
+                                          link.maxInterval == config.fast.maxInterval &&
+                                          link.connParamUpdates == updates + 2);
+    return failed;
+}
+#endif
+
+}  // namespace
+
+int main() {
+    memset(largeText, 'x', sizeof(largeText) - 1);
+    std::string largeParams = "{\"name\":\"large\",\"arguments\":{\"data\":\"" + std::string(2048, 'y') + "\"}}";
+
+    server.RegisterTool(echoTool);
+    server.RegisterTool(largeTool);
+    server.RegisterTool(cachedTool);
+    server.begin();
+    client.connect(247);
+
+#ifdef MCP_BENCH_ALLOC_CHECK
+    printf("allocation check (steady-state tools/call)\n");
+    int failed = runAllocCheck("tools/call", kSmallParams, 1000);
+    failed += runAllocCheck("tools/call cached", kCachedParams, 1000);
+    return failed ? 1 : 0;
+#endif
+
+#ifdef MCP_BENCH_LINK_CHECK
+    printf("link parameter check\n");
+    return runLinkCheck() ? 1 : 0;
+#endif
+
+#ifdef MCP_BENCH_REPLAY_CHECK
+    printf("replay check\n");
+    return runReplayCheck() ? 1 : 0;
+#endif
+
+    printf("request path (MTU 247)\n");
+    runScenario("initialize", "initialize",
+                "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{},"
+                "\"clientInfo\":{\"name\":\"bench\",\"version\":\"1\"}}",
+                2000);
+    runScenario("ping", "ping", nullptr, 5000);
+    runScenario("tools/call small", "tools/call", kSmallParams, 5000);
+    runScenario("tools/call cached", "tools/call", kCachedParams, 5000);
+    runScenario("tools/call large", "tools/call", largeParams.c_str(), 1000);
+    // 50 tools is about 11 KB of tools/list, past the 8 KB single-message
+    // limit; responses are streamed, so it is answered all the same.
+    const size_t toolCounts[] = {5, 20, 50};
+    for (size_t total : toolCounts) {
+        addFillers(total - 3);  // echo, large and cached_echo count too
+        char label[32];
+        snprintf(label, sizeof(label), "tools/list %u tools", (unsigned)total);
+        runScenario(label, "tools/list", nullptr, 1000);
+    }
+
+    printf("\nschema validation\n");
+    runValidation("small schema", kSmallSchema, kSmallArgs, 200000);
+    runValidation("medium schema", kMediumSchema, kMediumArgs, 100000);
+    runValidation("large schema", kLargeSchema, kLargeArgs, 20000);
+    return 0;
+}
@@ -0,0 +1,132 @@
+// Replays a capture saved by McpCapture on a device: received packets, MTU
+// changes, connects and disconnects are fed through McpBle, the transport
+// and the server in their original order, at the original pace with --realtime or as fast as
+// possible otherwise. The packets the server sends are compared with the
+// ones captured, and the first difference is reported.
+//
+//   pio run -e replay && .pio/build/replay/program capture.bin [--realtime]
+//
+// Register the firmware's tools in registerTools() so that tools/call
+// replays against the same handlers.
+#include <BLEMCPServer.h>
+#include <McpBle.h>
+#include <McpCapture.h>
+#include <mcp_transport.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+BLEMCPServer server("mcp-replay", "1.0.0");
+std::vector<std::string> sent;
+
+void registerTools(BLEMCPServer&) {}
+
+void onNotify(const uint8_t* data, size_t len, void*) {
+    sent.emplace_back((const char*)data, len);
+}
+
+bool readFile(const char* path, std::vector<uint8_t>& out) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        out.insert(out.end(), buffer, buffer + n);
+    }
+    fclose(file);
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <capture> [--realtime]\n", argv[0]);
+        return 2;
+    }
+    bool realtime = argc > 2 && strcmp(argv[2], "--realtime") == 0;
+    std::vector<uint8_t> capture;
+    if (!readFile(argv[1], capture)) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 2;
+    }
+    McpCaptureReader reader(capture.data(), capture.size());
+    if (!reader.valid()) {
+        fprintf(stderr, "%s is not a capture\n", argv[1]);
+        return 2;
+    }
+
+    registerTools(server);
+    server.begin();
+    hostBleSetNotifySink(onNotify, nullptr);
+    McpBle& ble = McpBle::getInstance();
+    NimBLEServer* bleServer = NimBLEDevice::createServer();
+    // Captures started mid-session have no connect record.
+    ble._onConnect(bleServer, 1);
+
+    std::vector<std::string> captured;
+    size_t received = 0;
+    size_t failed = 0;
+    NimBLECharacteristic rx;
+    const auto start = std::chrono::steady_clock::now();
+    McpCaptureReader::Frame frame;
+    while (reader.next(frame)) {
+        if (realtime) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(frame.timeUs));
+        }
+        switch (frame.kind) {
+            case MCP_TRANSPORT_CAPTURE_RX:
+                rx.setValue(frame.data, frame.len);
+                ble._onWrite(&rx);
+                server.loop();
+                received++;
+                break;
+            case MCP_TRANSPORT_CAPTURE_MTU:
+                if (frame.len == 2) {
+                    ble._onMtuChange((uint16_t)(frame.data[0] << 8 | frame.data[1]));
+                }
+                break;
+            case MCP_TRANSPORT_CAPTURE_CONNECT:
+                if (!ble.isConnected()) {
+                    ble._onConnect(bleServer, 1);
+                }
+                break;
+            case MCP_TRANSPORT_CAPTURE_DISCONNECT:
+                ble._onDisconnect(bleServer);
+                server.loop();
+                break;
+            case MCP_TRANSPORT_CAPTURE_TX_FAILED:
+                failed++;
+                // The packet was still produced.
+                // fall through
+            case MCP_TRANSPORT_CAPTURE_TX:
+                captured.emplace_back((const char*)frame.data, frame.len);
+                break;
+        }
+    }
+    server.loop();
+    const double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!reader.valid()) {
+        fprintf(stderr, "capture truncated\n");
+    }
+
+    printf("%zu packets received, %zu sent (%zu captured, %zu failed on the device) in %.3f s\n", received,
+           sent.size(), captured.size(), failed, elapsed);
+    for (size_t i = 0; i < sent.size() || i < captured.size(); i++) {
+        if (i >= sent.size() || i >= captured.size() || sent[i] != captured[i]) {
+            printf("first difference at sent packet %zu\n", i);
+            if (i < captured.size()) printf("  captured: %.*s\n", (int)captured[i].size() - 1, captured[i].c_str() + 1);
+            if (i < sent.size()) printf("  replayed: %.*s\n", (int)sent[i].size() - 1, sent[i].c_str() + 1);
+            return 1;
+        }
+    }
+    printf("sent packets match the capture\n");
+    return 0;
+}
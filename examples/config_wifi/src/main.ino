@@ -1,14 +1,25 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <BLEMCPServer.h>
+#include <McpToolArgs.h>
 
 BLEMCPServer mcpServer("ESP32-MCP-BLE", "1.0.0", "MCP WiFi configuration tool");
 
-class ConfigWifiHandler : public ToolHandler {
+struct WifiArgs {
+    const char* ssid;
+    const char* password;
+};
+
+MCP_TOOL_ARGS(WifiArgs,
+              MCP_ARG(WifiArgs, ssid, "WiFi SSID"),
+              MCP_ARG(WifiArgs, password, "WiFi password"));
+
+class ConfigWifiHandler : public TypedToolHandler<WifiArgs> {
    public:
-    DynamicJsonDocument call(const DynamicJsonDocument& params) override {
-        const char* ssid = params["ssid"].isNull() ? "" : params["ssid"].as<const char*>();
-        const char* password = params["password"].isNull() ? "" : params["password"].as<const char*>();
+    DynamicJsonDocument call(const WifiArgs& args) override {
+        // Both are required strings in the derived schema, checked before call().
+        const char* ssid = args.ssid;
+        const char* password = args.password;
         Serial.printf("WiFi config: ssid=%s\n", ssid);
 
         WiFi.mode(WIFI_STA);
@@ -20,6 +31,8 @@ class ConfigWifiHandler : public ToolHandler {
         while (WiFi.status() != WL_CONNECTED && (millis() - startMs) < 20000) {
             delay(250);
         }
+        // get_status results cached before the join are now wrong.
+        mcpServer.invalidateToolCache("get_status");
 
         DynamicJsonDocument result(256);
         result["status"] = (WiFi.status() == WL_CONNECTED) ? "connected" : "failed";
@@ -54,6 +67,22 @@ class GetStatusHandler : public ToolHandler {
     }
 };
 
+GetStatusHandler getStatusHandler;
+
+// Declared at compile time: the definition and its schema live in flash.
+constexpr ToolDefinition getStatusTool = {
+    "get_status",
+    "Get current WiFi status",
+    MCP_SCHEMA_EMPTY_OBJECT,
+    MCP_SCHEMA_OBJECT(MCP_SCHEMA_PROPERTIES(
+        MCP_SCHEMA_PROPERTY("status", MCP_SCHEMA_STRING("connected or disconnected")),
+        MCP_SCHEMA_PROPERTY("ssid", MCP_SCHEMA_STRING("Current SSID")),
+        MCP_SCHEMA_PROPERTY("ip", MCP_SCHEMA_STRING("IPv4 address, empty when disconnected")))),
+    &getStatusHandler,
+    1000,  // polled constantly; serve repeats from the result cache
+    ToolPriority::INTERACTIVE,
+};
+
 void setup() {
     Serial.begin(115200);
     delay(1000);
@@ -63,27 +92,11 @@ void setup() {
     Tool configWifiTool;
     configWifiTool.name = "config_wifi";
     configWifiTool.description = "Configure WiFi with ssid and password";
-    configWifiTool.inputSchema.type = "object";
-
-    Properties ssidProp;
-    ssidProp.type = "string";
-    ssidProp.description = "WiFi SSID";
-    configWifiTool.inputSchema.properties["ssid"] = ssidProp;
-    configWifiTool.inputSchema.required.push_back("ssid");
-
-    Properties passwordProp;
-    passwordProp.type = "string";
-    passwordProp.description = "WiFi password";
-    configWifiTool.inputSchema.properties["password"] = passwordProp;
-    configWifiTool.inputSchema.required.push_back("password");
+    configWifiTool.inputSchema = ConfigWifiHandler::inputSchema();
     configWifiTool.handler = std::make_shared<ConfigWifiHandler>();
+    configWifiTool.priority = ToolPriority::BULK;  // blocks up to 20 s joining
     mcpServer.RegisterTool(configWifiTool);
 
-    Tool getStatusTool;
-    getStatusTool.name = "get_status";
-    getStatusTool.description = "Get current WiFi status";
-    getStatusTool.inputSchema.type = "object";
-    getStatusTool.handler = std::make_shared<GetStatusHandler>();
     mcpServer.RegisterTool(getStatusTool);
 
     Serial.println("Starting MCP server...");
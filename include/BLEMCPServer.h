@@ -4,46 +4,68 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
 #include <vector>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
+#include "McpSchema.h"
+
 const char* const PROTOCOL_VERSION = "2024-11-05";
 const char* const DEFAULT_SERVER_NAME = "ESP32-MCP-BLE";
 const char* const DEFAULT_SERVER_VERSION = "1.0.0";
 
+// Stage records kept in the trace ring (12 bytes each).
+#ifndef MCP_TRACE_DEPTH
+#define MCP_TRACE_DEPTH 64
+#endif
+
+// FNV-1a. Usable in case labels, so built-in method names are dispatched
+// with a switch; duplicate hashes fail to compile.
+constexpr uint32_t mcpHash(const char* s, uint32_t h = 2166136261u) {
+    return *s ? mcpHash(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+// A parsed JSON-RPC message; id/params are read from the document in place.
+// The server reuses one across requests, so the document keeps its capacity.
 struct MCPRequest {
     std::string method;
-    DynamicJsonDocument idDoc;
-    DynamicJsonDocument paramsDoc;
+    DynamicJsonDocument doc;
 
-    MCPRequest() : method(""), idDoc(256), paramsDoc(4096) {}
+    MCPRequest() : method(""), doc(0) {}
 
     JsonVariantConst params() const {
-        return paramsDoc.as<JsonVariantConst>();
+        return doc["params"];
     }
 
     JsonVariantConst id() const {
-        return idDoc.as<JsonVariantConst>();
+        return doc["id"];
     }
 
     bool hasParams() const {
-        return !paramsDoc.isNull();
+        return !params().isNull();
     }
 };
 
 struct MCPResponse {
+    // Result capacity used when a handler does not give one.
+    static constexpr size_t DEFAULT_RESULT_CAPACITY = 1024;
+
     DynamicJsonDocument idDoc;
     DynamicJsonDocument resultDoc;
     DynamicJsonDocument errorDoc;
     int httpStatusCode;
+    bool sent = false;  // already written to the transport by the handler
 
-    MCPResponse() : idDoc(256), resultDoc(8192), errorDoc(512), httpStatusCode(200) {}
-    MCPResponse(const JsonVariantConst& id) : idDoc(256), resultDoc(8192), errorDoc(512), httpStatusCode(200) {
+    MCPResponse() : idDoc(0), resultDoc(DEFAULT_RESULT_CAPACITY), errorDoc(0), httpStatusCode(200) {}
+    MCPResponse(const JsonVariantConst& id, size_t resultCapacity = DEFAULT_RESULT_CAPACITY, size_t errorCapacity = 0)
+        : idDoc(idCapacity(id)), resultDoc(resultCapacity), errorDoc(errorCapacity), httpStatusCode(200) {
         idDoc.set(id);
     }
 
@@ -63,10 +85,32 @@ struct MCPResponse {
     bool hasError() const {
         return !errorDoc.isNull();
     }
+
+    size_t capacity() const {
+        return idDoc.capacity() + resultDoc.capacity() + errorDoc.capacity();
+    }
+
+    // Numbers live in the root variant; only string ids need pool space.
+    static size_t idCapacity(const JsonVariantConst& id) {
+        return id.is<const char*>() ? strlen(id.as<const char*>()) + 1 : 0;
+    }
+};
+
+// JSON memory used per request, in bytes: the parsed request, the response
+// documents and the serialized response.
+struct MemoryStats {
+    size_t budget;
+    size_t last;
+    size_t peak;
+    size_t average;
+    uint32_t requests;
+    uint32_t overBudget;  // requests answered with a budget error
 };
 
 enum class ErrorCode {
     SERVER_ERROR = -32000,
+    SERVER_BUSY = -32001,
+    RESOURCE_NOT_FOUND = -32002,
     INVALID_REQUEST = -32600,
     METHOD_NOT_FOUND = -32601,
     INVALID_PARAMS = -32602,
@@ -78,6 +122,44 @@ class ToolHandler {
    public:
     virtual ~ToolHandler() = default;
     virtual DynamicJsonDocument call(const DynamicJsonDocument& params) = 0;
+
+    // Entry point used by the server. The default copies the arguments into
+    // a document for call(); handlers that read them in place override it.
+    virtual DynamicJsonDocument invoke(JsonVariantConst arguments);
+
+    // Writes the result into `result`, a cleared document the server reuses
+    // across calls; returns false if it does not fit. Handlers that override
+    // this make no heap allocations once warmed up. The default calls
+    // invoke() and copies its document.
+    virtual bool invokeInto(JsonVariantConst arguments, DynamicJsonDocument& result);
+
+    // Checks the schema cannot express, run on the server task after schema
+    // validation; false rejects the call with INVALID_PARAMS and
+    // `error.message`. The default accepts everything.
+    virtual bool checkArguments(JsonVariantConst arguments, SchemaValidator::Error& error);
+
+    // Non-null for tools whose input arrives as a stream.
+    virtual class StreamingToolHandler* streaming() { return nullptr; }
+};
+
+// Tool whose input is a byte stream sent as blob frames after the call (see
+// Streaming Tool Input in the README). The callbacks run on the server task,
+// one stream at a time, as the frames arrive; the server's buffer bounds
+// what the client may send ahead.
+class StreamingToolHandler : public ToolHandler {
+   public:
+    // Called with the validated arguments and the announced stream length;
+    // returning false refuses the call.
+    virtual bool begin(JsonVariantConst arguments, size_t size) = 0;
+    // The next bytes of the stream; returning false aborts it.
+    virtual bool chunk(const uint8_t* data, size_t len) = 0;
+    // Ends the stream, `complete` if every byte was delivered. The result
+    // is sent as the tool's response; false if it does not fit `result`.
+    virtual bool end(bool complete, DynamicJsonDocument& result) = 0;
+
+    // Streaming tools are never called with a document.
+    DynamicJsonDocument call(const DynamicJsonDocument& params) override;
+    StreamingToolHandler* streaming() override { return this; }
 };
 
 class Properties {
@@ -125,6 +207,7 @@ class Properties {
             allOf = other.allOf;
             format = other.format;
             defaultValue = other.defaultValue;
+            flatCache.reset();
         }
         return *this;
     }
@@ -154,9 +237,24 @@ class Properties {
     String defaultValue;
 
     String toString() const;
+    // Leaves `obj` empty for trees FlatSchema rejects (deeper than
+    // FlatSchema::MAX_DEPTH).
     void toJson(JsonObject& obj) const;
+
+    // The tree flattened by the first call (or by RegisterTool()) and reused
+    // afterwards, so edits made after that are not seen; copies start
+    // without it. Empty if FlatSchema rejects the tree.
+    const FlatSchema& flat() const;
+
+   private:
+    mutable std::shared_ptr<const FlatSchema> flatCache;
 };
 
+// Scheduling hint. Queued interactive calls are always handled before bulk
+// ones (captures, long transfers, WiFi joins), so cheap calls do not wait
+// behind them.
+enum class ToolPriority : uint8_t { INTERACTIVE = 0, BULK = 1 };
+
 class Tool {
    public:
     Tool() = default;
@@ -170,50 +268,533 @@ class Tool {
     Properties inputSchema;
     Properties outputSchema;
     std::shared_ptr<ToolHandler> handler;
+    // Idempotent tools may set a TTL: results are then cached per argument
+    // set and served without calling the handler until they expire.
+    uint32_t cacheTtlMs = 0;
+    ToolPriority priority = ToolPriority::INTERACTIVE;
 
     String toString() const;
 };
 
+// Tool declared entirely at compile time. Schemas are JSON text (see
+// McpSchema.h), so a `constexpr ToolDefinition` lives in flash and is
+// registered by pointer without copying anything to the heap.
+struct ToolDefinition {
+    const char* name;
+    const char* description;
+    const char* inputSchema;
+    const char* outputSchema;  // nullptr when the tool has no output schema
+    ToolHandler* handler;
+    uint32_t cacheTtlMs;    // see Tool::cacheTtlMs; 0 when omitted
+    ToolPriority priority;  // INTERACTIVE when omitted
+};
+
+// Source of a resource's bytes. Reads happen on demand while the response is
+// streamed, so a resource is never held in RAM as a whole.
+class ResourceProvider {
+   public:
+    virtual ~ResourceProvider() = default;
+    virtual size_t size() = 0;
+    // Copies up to `len` bytes at `offset` into `buffer`; returns the count,
+    // 0 past the end.
+    virtual size_t read(size_t offset, uint8_t* buffer, size_t len) = 0;
+};
+
+class Resource {
+   public:
+    String uri;
+    String name;
+    String description;
+    String mimeType;
+    bool binary = false;  // served base64-encoded as "blob" instead of "text"
+    std::shared_ptr<ResourceProvider> provider;
+};
+
+// Raw bytes received as blob frames (see Binary Blobs in the README).
+struct McpBlob {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size = 0;
+};
+
+// Receive queue occupancy. Per-class arrays are indexed control,
+// interactive, bulk (see Request Priority in the README).
+struct QueueStats {
+    size_t depth;  // slots per class
+    size_t waiting[3];
+    size_t peak[3];
+    uint32_t accepted;
+    uint32_t rejected;  // answered "server busy"
+};
+
+// Server tasks: dispatch takes queued messages, parses them and runs the
+// built-in and custom methods; tool runs tool handlers.
+enum class TaskStage : uint8_t { DISPATCH, TOOL };
+
+// Placement of a server task. The stack size is in bytes, as ESP-IDF counts
+// it; core is tskNO_AFFINITY to let the scheduler choose.
+struct TaskConfig {
+    uint32_t stackBytes;
+    UBaseType_t priority;
+    BaseType_t core;
+};
+
+struct TaskStats {
+    bool running;
+    UBaseType_t priority;
+    BaseType_t core;
+    uint32_t stackBytes;
+    uint32_t stackFreeMin;  // high-water mark: least free stack seen, in bytes
+};
+
+enum class TraceStage : uint8_t {
+    RX_FIRST,    // first fragment received
+    RX_DONE,     // message reassembled and queued
+    DEQUEUED,    // taken by the server task
+    PARSED,      // arg: message length
+    HANDLED,     // handler returned
+    SERIALIZED,  // arg: response length
+    TX_BEGIN,    // transport lock taken; arg: message length
+    TX_END,      // last packet sent; arg: 1 on success
+};
+
+// One timestamped stage of a request. `cycles` is the CPU cycle counter;
+// dumped little-endian by the diagnostics method.
+struct TraceRecord {
+    uint32_t cycles;
+    uint32_t arg;
+    uint16_t request;  // sequence number; 0 for sends outside a request
+    uint8_t stage;     // TraceStage
+    uint8_t reserved;
+};
+
 class BLEMCPServer {
    public:
+    using MethodHandler = std::function<MCPResponse(MCPRequest& request)>;
+
     BLEMCPServer(const String& name = DEFAULT_SERVER_NAME, const String& version = DEFAULT_SERVER_VERSION,
                  const String& instructions = "");
     
+    // Tools can be registered and removed at any time, from any task, without
+    // pausing request handling. A connected client is sent
+    // notifications/tools/list_changed.
     void RegisterTool(const Tool& tool);
+    // The definition is referenced, not copied: it must have static storage.
+    void RegisterTool(const ToolDefinition& definition);
+    // Registers all definitions as one change.
+    void RegisterTools(const ToolDefinition* definitions, size_t count);
+    template <size_t N>
+    void RegisterTools(const ToolDefinition (&definitions)[N]) {
+        RegisterTools(definitions, N);
+    }
+    // Returns false if no tool has that name.
+    bool UnregisterTool(const String& name);
+    // Resources and methods, unlike tools, must be registered before
+    // begin(); later calls are rejected with a log message.
+    void RegisterResource(const Resource& resource);
+    // Adds a JSON-RPC method. Built-in methods cannot be replaced.
+    void RegisterMethod(const String& method, MethodHandler handler);
     void begin();
     void loop();
 
+    // Sends a JSON-RPC notification to the client. Safe from any task.
+    bool notify(const char* method, JsonVariantConst params = JsonVariantConst());
+    // Signals that a resource changed. Subscribed clients get
+    // notifications/resources/updated; repeated updates within the
+    // notification interval are coalesced into one.
+    void notifyResourceUpdated(const String& uri);
+    void setNotificationInterval(uint32_t intervalMs);
+
+    // Drops cached results of one tool, or of every tool when null, e.g.
+    // after firmware changed the state a cached tool reports. Safe from any
+    // task.
+    void invalidateToolCache(const char* toolName = nullptr);
+    // Slots per priority class in the receive queue (4 by default). When a
+    // class is full, new requests get an immediate SERVER_BUSY error with a
+    // retryAfterMs hint instead of being dropped. Call before begin().
+    void setQueueDepth(size_t depth);
+    void setBusyRetryAfter(uint32_t retryAfterMs);
+    QueueStats getQueueStats() const;
+
+    // Bounds the table of completed responses replayed to clients that
+    // resend a request id after reconnecting (8 entries / 4 KB by default;
+    // 0 entries disables it). Call before begin().
+    void setReplayLimits(size_t entries, size_t bytes);
+    // Number of cached tool results kept (least recently used are evicted).
+    // Call before begin().
+    void setToolCacheSize(size_t entries);
+    // Preallocated receive buffers: messages up to `bytes` long are queued
+    // in one of `count` fixed slots instead of a heap copy (4 x 512 by
+    // default, at most 32 slots). Call before begin().
+    void setReceiveSlots(size_t count, size_t bytes);
+
+    // Binary side channel. Clients send blobs as raw frames and refer to
+    // them from JSON by id; received blobs are held until a handler takes
+    // them or the limits (4 blobs / 32 KB by default) evict the oldest.
+    void setBlobLimits(size_t count, size_t bytes);
+    // Moves a completely received blob out; false if unknown or incomplete.
+    bool takeBlob(uint16_t id, McpBlob& blob);
+    // Sends `size` raw bytes to the client as a new blob and returns its id
+    // (0 on failure). Write exactly `size` bytes, then call endBlob(); the
+    // transport is held in between. Send the blob before the response that
+    // refers to it.
+    uint16_t beginBlob(size_t size);
+    bool writeBlob(const uint8_t* data, size_t len);
+    bool endBlob();
+
+    // Bytes of streamed tool input buffered ahead of the handler, which is
+    // also the window a client may send ahead of its credit (4 KB by
+    // default). Call before begin().
+    void setStreamWindow(size_t bytes);
+
+    // A stream that neither receives nor consumes data for this long is
+    // aborted (10 s by default, 0 to wait forever).
+    void setStreamTimeout(uint32_t ms);
+
+    // Dispatch runs with 4 KB of stack at priority 1 on any core by
+    // default. The tool stage is off (stackBytes 0), so handlers run on the
+    // dispatch task. With a tool task, each tool call or streaming callback
+    // is handed to it and the dispatch task waits: handlers get their own
+    // stack and core, but still run one at a time. Call before begin().
+    // Stacks are at least 2 KB; a tool task that cannot be created falls
+    // back to running handlers on the dispatch task.
+    void setTaskConfig(TaskStage stage, const TaskConfig& config);
+    TaskStats getTaskStats(TaskStage stage) const;
+
+    // Caps the JSON memory a single request may use. Requests or responses
+    // that would exceed it are answered with SERVER_ERROR instead.
+    void setMemoryBudget(size_t bytes);
+    MemoryStats getMemoryStats() const;
+
+    static MCPResponse createJSONRPCError(int code, const JsonVariantConst& id, const std::string& message);
+
    private:
-    static void onMessage(const char* message, void* ctx);
-    void processMessage(const char* message);
-    
-    std::string serializeResponse(const MCPResponse& response);
-    void sendResponse(const std::string& jsonResponse, int httpStatusCode);
+    // Queued copy of a received message.
+    struct RxMessage {
+        uint32_t rxDoneUs;
+        uint16_t seq;
+        char text[1];
+    };
 
-    MCPRequest parseRequest(const std::string& json);
+    static void onMessage(const char* message, void* ctx);
+    RxMessage* allocMessage(size_t length);
+    void freeMessage(RxMessage* message);
+    void processMessage(RxMessage* message);
+    void dispatchMessage(const char* message, MCPRequest& request);
+    // Routes from a scan of the raw text; true if the message needs no full
+    // parse (notifications, unknown methods, non-string methods).
+    bool prescreen(const char* message, MCPRequest& request);
+    // Sends an error echoing `id` as it appeared in the request.
+    void sendScannedError(const char* id, size_t idLength, int code, const char* message, const char* detail);
+    void trimBuffers();
+
+    static void serializeResponse(const MCPResponse& response, std::string& out);
+    void sendResponse(const char* jsonResponse, int httpStatusCode);
+    // Serializes `response` into txBuffer and sends it; false if it went
+    // over the memory budget (an error is sent instead).
+    bool respond(const MCPRequest& request, MCPResponse response);
+
+    DeserializationError parseRequest(const char* json, MCPRequest& request);
+    bool isReplayable(const MCPRequest& request) const;
+    // Accounts `bytes` to the current request; false once over budget.
+    bool chargeRequest(size_t bytes);
+    size_t remainingBudget() const;
+    void recordRequest(bool overBudget);
 
-    MCPResponse createJSONRPCError(int code, const JsonVariantConst& id, const std::string& message);
     MCPResponse handle(MCPRequest& request);
     MCPResponse handleInitialize(MCPRequest& request);
     MCPResponse handleInitialized(MCPRequest& request);
+    MCPResponse handlePing(MCPRequest& request);
+    MCPResponse handleDiagnostics(MCPRequest& request);
     MCPResponse handleToolsList(MCPRequest& request);
-    MCPResponse handleFunctionCalls(MCPRequest& request);
+    bool handleFunctionCalls(MCPRequest& request);
+    MCPResponse handleResourcesList(MCPRequest& request);
+    MCPResponse handleResourcesRead(MCPRequest& request);
+    MCPResponse handleResourcesSubscribe(MCPRequest& request, bool subscribe);
+    // On failure nothing complete was sent and `error` says why.
+    bool streamResource(JsonVariantConst id, const Resource& resource, size_t offset, size_t length, size_t total,
+                        const char*& error);
+    struct ToolEntry;
+    bool callTool(MCPRequest& request, const ToolEntry& tool, JsonVariantConst arguments);
+    bool sendToolResult(const MCPRequest& request, const std::string& text);
+    void sendToolError(const MCPRequest& request, const char* message);
+    // Appends the result after the id already in txBuffer and sends it.
+    void finishToolResult(const char* text, bool isError);
+    bool beginInput(MCPRequest& request, const ToolEntry& tool, StreamingToolHandler& handler,
+                    JsonVariantConst arguments);
+    void feedInput(uint32_t offset, const uint8_t* data, size_t len);
+    void adoptInput();
+    // Feeds buffered stream input to the handler; server task. Returns the
+    // milliseconds until the stream times out, UINT32_MAX without one.
+    uint32_t drainInput();
+    void endInput(bool complete);
+    void sendCredit();
+    const std::string* findCachedResult(const std::string& key, uint32_t hash, uint32_t epoch);
+    void storeCachedResult(const std::string& key, uint32_t hash, uint32_t epoch, uint32_t ttlMs,
+                           const std::string& text);
 
     // BLE Transport members
     static void taskEntry(void* ctx);
+    static void toolTaskEntry(void* ctx);
+    // Runs fn(arg) on the tool task and waits for it, or runs it here when
+    // there is no tool task.
+    void runTool(void (*fn)(void*), void* arg);
     static int sendBytes(const uint8_t* data, size_t len, void* ctx);
     static void onMtu(uint16_t mtu);
     static void sleepTicks(uint32_t ticks, void* ctx);
     static void logFn(int level, const char* tag, const char* message, void* ctx);
-
-    QueueHandle_t rx_queue = nullptr;
+    static void lockFn(bool lock, void* ctx);
+    static void traceFn(int event, size_t len, void* ctx);
+    static void onConnection(bool connected);
+    static void onBlob(uint16_t id, uint32_t total, uint32_t offset, const uint8_t* data, size_t len, void* ctx);
+
+    // Sends due resource notifications; returns ticks until the next is due.
+    TickType_t flushNotifications();
+    void wake();
+
+    // Incoming messages are queued per class and taken highest class first.
+    enum RequestClass : uint8_t { CLASS_CONTROL, CLASS_INTERACTIVE, CLASS_BULK, CLASS_COUNT };
+    RequestClass classify(const char* message) const;
+    RxMessage* takeMessage();
+    void rejectBusy(const char* message);
+
+    QueueHandle_t rx_queues[CLASS_COUNT] = {};
+    uint8_t* rxSlots = nullptr;
+    uint32_t rxSlotsFree = 0;  // bit per free slot, guarded by stats_mux
+    size_t rxSlotCount = 4;
+    size_t rxSlotSize = 512;
+    SemaphoreHandle_t rx_ready = nullptr;  // one count per queued message or wake
+    uint8_t passedOver[CLASS_COUNT] = {};  // times a waiting class was skipped
+    size_t queueDepth = 4;
+    QueueStats queueStats = {};
+    // Busy reply after the id, serialized when the retry hint is set.
+    char busyTail[112] = {};
+
+    // Stage trace, guarded by stats_mux. traceRequest tags stages recorded
+    // while a request is processed.
+    void trace(TraceStage stage, uint32_t arg, uint16_t request, uint32_t cycles);
+    void trace(TraceStage stage, uint32_t arg);
+    TraceRecord traceRing[MCP_TRACE_DEPTH] = {};
+    uint32_t traceNext = 0;
+    uint32_t rxStartCycles = 0;
+    uint16_t rxSeq = 0;
+    uint16_t traceRequest = 0;
+
+    // Request latency, receipt to response sent; server task only. Bucket i
+    // counts latencies below 128 us << i, the last one everything above.
+    static const size_t LATENCY_BUCKETS = 16;
+    struct LatencyStats {
+        uint32_t hash;
+        bool tool;
+        std::string name;
+        uint32_t count;
+        uint32_t maxUs;
+        uint64_t totalUs;
+        uint16_t buckets[LATENCY_BUCKETS];
+    };
+    void recordLatency(const MCPRequest& request, uint32_t elapsedUs);
+    void addLatency(const char* name, bool tool, uint32_t elapsedUs);
+    std::vector<LatencyStats> latency;
+    size_t diagnosticsCapacity = 2048;
     TaskHandle_t task_handle = nullptr;
+    TaskConfig dispatchTask = {4096, 1, tskNO_AFFINITY};
+    TaskConfig toolTask = {0, 1, tskNO_AFFINITY};
+    TaskHandle_t tool_task = nullptr;
+    SemaphoreHandle_t tool_start = nullptr;
+    SemaphoreHandle_t tool_done = nullptr;
+    void (*toolJob)(void*) = nullptr;
+    void* toolJobArg = nullptr;
+    SemaphoreHandle_t tx_lock = nullptr;
+    portMUX_TYPE notify_mux = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t notificationIntervalMs = 100;
+
+    mutable portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+    size_t memoryBudget = 32768;
+    size_t requestBytes = 0;
+    uint64_t totalRequestBytes = 0;
+    MemoryStats memoryStats = {};
+    // Last capacities that fit, so list results are allocated once.
+    size_t toolsListCapacity = 1024;
+    size_t resourcesListCapacity = 512;
+
+    // Blobs being received or waiting to be taken, oldest first.
+    struct BlobEntry {
+        uint16_t id;
+        uint32_t received;
+        McpBlob blob;
+    };
+    std::vector<BlobEntry> rxBlobs;  // blob_lock
+    SemaphoreHandle_t blob_lock = nullptr;
+    size_t blobLimit = 4;
+    size_t blobBytesLimit = 32768;
+    std::atomic<uint16_t> txBlobId{0};
+
+    // Streamed tool input. Frames are copied into inputRing on the BLE task
+    // (the only writer of inputHead) and handed to the handler on the
+    // server task (the only writer of inputTail); the rest is server task
+    // state. The client may send up to inputTail + inputWindow bytes.
+    struct InputStream {
+        StreamingToolHandler* handler = nullptr;
+        std::shared_ptr<ToolHandler> owner;  // keeps a runtime tool alive
+        std::string requestId;               // serialized
+        uint32_t size = 0;
+        uint32_t credited = 0;               // inputTail when credit was last sent
+        uint32_t seenHead = 0;               // inputHead at the last drainInput()
+        uint32_t progressMs = 0;             // when data last arrived or was taken
+        uint16_t blobId = 0;
+    };
+    InputStream input;
+    std::unique_ptr<uint8_t[]> inputRing;
+    size_t inputWindow = 4096;
+    uint32_t inputTimeoutMs = 10000;
+    std::atomic<bool> inputActive{false};
+    std::atomic<bool> inputBroken{false};  // overflow, lost frame or disconnect
+    std::atomic<uint32_t> inputHead{0};
+    std::atomic<uint32_t> inputTail{0};
+
+    // Reused by every request on the server task. They keep their capacity,
+    // so the steady state makes no heap allocations; trimBuffers() releases
+    // what an unusually large request grew them to.
+    MCPRequest rxRequest;
+    size_t requestCapacity = 1024;
+    DynamicJsonDocument toolResultDoc{0};
+    size_t toolResultCapacity = 512;
+    std::string toolText;  // serialized tool result
+    std::string cacheKey;
+    std::string txBuffer;  // serialized response
+    bool txReplayable = true;  // txBuffer may be stored in the replay table
 
     static BLEMCPServer* s_bound;
     static bool s_initialized;
 
    private:
-    std::map<String, Tool> tools;
+    // Registered tool. Compile-time tools only reference their definition;
+    // runtime tools own flattened schemas and the Properties tree is not kept.
+    struct ToolEntry {
+        uint32_t hash = 0;
+        const ToolDefinition* definition = nullptr;
+        String name;
+        String description;
+        FlatSchema inputSchema;
+        FlatSchema outputSchema;
+        SchemaValidator validator;
+        std::shared_ptr<ToolHandler> handler;
+        uint32_t cacheTtlMs = 0;
+        ToolPriority priority = ToolPriority::INTERACTIVE;
+        // Replaced to invalidate cached results; written under tools_lock
+        // and read by callTool() without it. A copied entry starts with the
+        // value the original had.
+        struct Epoch {
+            std::atomic<uint32_t> value{0};
+            Epoch() = default;
+            Epoch(const Epoch& other) noexcept : value(other.value.load(std::memory_order_relaxed)) {}
+            Epoch& operator=(const Epoch& other) noexcept {
+                value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                return *this;
+            }
+        };
+        mutable Epoch cacheEpoch;
+
+        const char* toolName() const { return definition ? definition->name : name.c_str(); }
+        ToolHandler* toolHandler() const { return definition ? definition->handler : handler.get(); }
+        uint32_t cacheTtl() const { return definition ? definition->cacheTtlMs : cacheTtlMs; }
+        ToolPriority toolPriority() const { return definition ? definition->priority : priority; }
+    };
+
+    struct ResourceEntry {
+        uint32_t hash = 0;
+        Resource resource;
+        // Session state, guarded by notify_mux.
+        bool subscribed = false;
+        bool pending = false;
+        bool notified = false;
+        uint32_t lastNotifyMs = 0;
+    };
+
+    // Serialized tool result, keyed by tool name and arguments.
+    struct CachedResult {
+        uint32_t hash;
+        uint32_t epoch;
+        uint32_t expiresMs;
+        std::string key;
+        std::string text;
+    };
+
+    // Completed response, replayed when the same request is resent. The
+    // serialized id and the NUL-terminated response are stored back to back
+    // in replayArena.
+    struct ReplayEntry {
+        uint32_t requestHash;  // whole message, so a reused id is not replayed
+        uint32_t offset;
+        uint32_t idLength;
+        uint32_t responseLength;
+    };
+
+    struct MethodEntry {
+        uint32_t hash;
+        String name;
+        MethodHandler handler;
+    };
+
+    const ReplayEntry* findReplay(const char* id, size_t idLength, uint32_t requestHash) const;
+    void storeReplay(const char* id, size_t idLength, uint32_t requestHash, const std::string& response);
+    bool replayOverlaps(size_t offset, size_t length) const;
+    using ToolTable = std::vector<ToolEntry>;  // sorted by hash
+    static void insertTool(ToolTable& table, ToolEntry&& entry);
+    static const ToolEntry* findTool(const ToolTable* table, const char* name);
+
+    // Pins the current tool table until destroyed. Taking one never blocks.
+    class ToolSnapshot {
+       public:
+        explicit ToolSnapshot(const BLEMCPServer& server);
+        ~ToolSnapshot();
+        ToolSnapshot(const ToolSnapshot&) = delete;
+        ToolSnapshot& operator=(const ToolSnapshot&) = delete;
+
+        const ToolEntry* find(const char* name) const { return findTool(table, name); }
+        const ToolEntry* begin() const { return table ? table->data() : nullptr; }
+        const ToolEntry* end() const { return table ? table->data() + table->size() : nullptr; }
+
+       private:
+        const BLEMCPServer& server;
+        const ToolTable* table;
+    };
+
+    // Copies the table, applies `edit` (which returns whether it changed
+    // anything) and publishes the copy.
+    template <typename Edit>
+    bool updateTools(Edit edit);
+    void reclaimTools();
+    ResourceEntry* findResource(const char* uri);
+    const MethodEntry* findMethod(const char* name, uint32_t hash) const;
+    static bool isBuiltinMethod(const char* name, uint32_t hash);
+
+    // Read-copy-update: readers pin the published table with a ToolSnapshot,
+    // writers (serialized by tools_lock) publish a modified copy and retire
+    // the old table, which is freed once no snapshot is left.
+    std::atomic<ToolTable*> toolTable{nullptr};
+    mutable std::atomic<uint32_t> toolReaders{0};
+    std::vector<ToolTable*> retiredTools;  // tools_lock
+    std::atomic<bool> toolsRetired{false};
+    SemaphoreHandle_t tools_lock = nullptr;
+    // Tools used by the request being processed; server task only.
+    const ToolSnapshot* requestTools = nullptr;
+    // Source of ToolEntry::cacheEpoch values, unique across tool versions.
+    uint32_t cacheEpochs = 0;  // tools_lock
+    bool toolsChanged = false;  // notify_mux
+    // All sorted by hash.
+    std::vector<ResourceEntry> resources;
+    std::vector<MethodEntry> methods;
+    // Most recently used first.
+    std::vector<CachedResult> toolCache;
+    size_t toolCacheSize = 4;
+    // Kept across reconnects and initialize, bounded by replayLimit and
+    // replayBytesLimit. Oldest first; replayArena is written as a ring from
+    // replayHead.
+    std::vector<ReplayEntry> replay;
+    std::unique_ptr<char[]> replayArena;
+    size_t replayHead = 0;
+    size_t replayLimit = 8;
+    size_t replayBytesLimit = 4096;
     String serverName;
     String serverVersion;
     String serverInstructions;
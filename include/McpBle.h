@@ -3,23 +3,76 @@
 #include <Arduino.h>
 #include <NimBLEDevice.h>
 #include <functional>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Picks the connection profile from link activity: fast while data moves,
+// slow once the link has been idle for the timeout. Makes no NimBLE calls,
+// so it can be driven with synthetic timestamps.
+class McpLinkPolicy {
+public:
+    enum Profile : uint8_t { PROFILE_NONE, PROFILE_FAST, PROFILE_SLOW };
+
+    void setIdleTimeout(uint32_t ms);
+    void reset();
+    // Both return the profile to switch to, or PROFILE_NONE to stay.
+    Profile onActivity(uint32_t nowMs);
+    // `waitMs` is set to the time until the next change is possible
+    // (UINT32_MAX if none is pending).
+    Profile poll(uint32_t nowMs, uint32_t& waitMs);
+    Profile current() const { return _current; }
+
+private:
+    uint32_t _idleTimeoutMs = 2000;
+    uint32_t _lastActivityMs = 0;
+    Profile _current = PROFILE_NONE;
+};
 
 class McpBle {
 public:
     using RxCallback = std::function<void(const uint8_t* data, size_t len)>;
     using MtuCallback = std::function<void(uint16_t mtu)>;
+    using ConnectionCallback = std::function<void(bool connected)>;
+
+    // Connection parameters in BLE units: intervals of 1.25 ms, supervision
+    // timeout of 10 ms.
+    struct LinkProfile {
+        uint16_t minInterval;
+        uint16_t maxInterval;
+        uint16_t latency;
+        uint16_t timeout;
+    };
+
+    struct LinkConfig {
+        LinkProfile fast = {6, 12, 0, 400};    // 7.5-15 ms
+        LinkProfile slow = {80, 160, 4, 600};  // 100-200 ms, may skip 4 events
+        uint32_t idleTimeoutMs = 2000;         // 0 stays on the fast profile
+        uint16_t preferredMtu = 517;
+        bool dataLengthExtension = true;       // 251-byte link-layer packets
+        bool phy2M = true;                     // where the controller has it
+    };
 
     static McpBle& getInstance();
 
     void init(const std::string& deviceName = "MCP_Server_BLE");
     void setRxCallback(RxCallback cb);
     void setMtuCallback(MtuCallback cb);
+    void setConnectionCallback(ConnectionCallback cb);
     bool sendNotification(const uint8_t* data, size_t len);
     uint16_t getMtu() const;
     bool isConnected() const;
 
+    // Takes effect from the next connection; the MTU only if set before init().
+    void setLinkConfig(const LinkConfig& config);
+    const LinkConfig& getLinkConfig() const;
+    McpLinkPolicy::Profile getLinkProfile() const;
+    // Drops to the slow profile once the link is idle. Called from the MCP
+    // server task; returns the milliseconds until it is due again
+    // (UINT32_MAX when nothing is pending).
+    uint32_t pollLink(uint32_t nowMs);
+
     // Internal usage
-    void _onConnect(NimBLEServer* pServer);
+    void _onConnect(NimBLEServer* pServer, uint16_t connHandle);
     void _onDisconnect(NimBLEServer* pServer);
     void _onMtuChange(uint16_t mtu);
     void _onWrite(NimBLECharacteristic* pCharacteristic);
@@ -30,12 +83,26 @@ private:
     McpBle(const McpBle&) = delete;
     McpBle& operator=(const McpBle&) = delete;
 
+    void noteActivity();
+    // Requests the policy's current profile unless already requested.
+    void applyLinkProfile();
+
     RxCallback _rxCallback;
     MtuCallback _mtuCallback;
+    ConnectionCallback _connectionCallback;
     uint16_t _mtu = 23;
     bool _connected = false;
     NimBLEServer* _pServer = nullptr;
     NimBLECharacteristic* _pTxCharacteristic = nullptr;
+    uint16_t _connHandle = 0;
+
+    LinkConfig _linkConfig;
+    McpLinkPolicy _linkPolicy;
+    // Guards _linkPolicy; taken on every packet, so a spinlock.
+    portMUX_TYPE _linkMux = portMUX_INITIALIZER_UNLOCKED;
+    // Serializes the parameter requests themselves.
+    SemaphoreHandle_t _linkLock = nullptr;
+    McpLinkPolicy::Profile _appliedProfile = McpLinkPolicy::PROFILE_NONE;
 
     const char* SERVICE_UUID = "00001999-0000-1000-8000-00805F9B34FB";
     const char* RX_UUID = "4963505F-5258-4000-8000-00805F9B34FB";
@@ -0,0 +1,104 @@
+#ifndef MCP_CAPTURE_H
+#define MCP_CAPTURE_H
+
+#include <Arduino.h>
+
+#include <functional>
+#include <memory>
+
+#include "freertos/FreeRTOS.h"
+
+// Transport traffic capture.
+//
+// Records every packet received and sent, send failures, MTU changes and
+// connects and disconnects, with their time, into a RAM ring. The oldest frames are dropped when it is
+// full. save() writes the capture out, e.g. to flash after a fault, and
+// bench/src/replay.cpp feeds it back into the server on the host.
+//
+//   static McpCapture capture(16384);
+//   capture.start();
+//   ...
+//   capture.save([](const uint8_t* data, size_t len) { return file.write(data, len) == len; });
+//
+// Format: "MCPC", a version byte (1), then one record per frame:
+//
+//   kind (1 byte, MCP_TRANSPORT_CAPTURE_*)  delta_us (varint)  len (varint)  data
+//
+// Varints are LEB128. delta_us is the time since the previous record; the
+// first record of a saved capture has 0. MTU records carry the new MTU as
+// 2 bytes big-endian; connect and disconnect records have no data.
+//
+// The transport calls the hook from the BLE and sending tasks without a
+// lock. A started capture must outlive the transport's use of it (make it
+// static or global), and start(), stop() and the destructor must only run
+// while no traffic is flowing, e.g. before begin() or while disconnected.
+class McpCapture {
+   public:
+    using Writer = std::function<bool(const uint8_t* data, size_t len)>;
+
+    explicit McpCapture(size_t bytes);
+    ~McpCapture();
+    McpCapture(const McpCapture&) = delete;
+    McpCapture& operator=(const McpCapture&) = delete;
+
+    // Installs the transport hook; one capture can be active at a time.
+    // stop() only removes the hook if this capture installed it.
+    void start();
+    void stop();
+    void clear();
+
+    // Writes the capture, oldest frame first. Frames arriving meanwhile
+    // are not recorded (they count as dropped).
+    bool save(const Writer& write);
+
+    size_t frames() const { return records; }
+    size_t dropped() const { return droppedFrames; }
+
+   private:
+    static void onFrame(int kind, const uint8_t* data, size_t len, void* ctx);
+    void record(uint8_t kind, const uint8_t* data, size_t len);
+    void put(const uint8_t* data, size_t len);
+    uint8_t peek(size_t index) const;
+    // Header of the record at ring offset `at`; returns the header length.
+    size_t readHeader(size_t at, uint8_t& kind, uint32_t& delta, uint32_t& len) const;
+    void dropOldest();
+
+    std::unique_ptr<uint8_t[]> ring;
+    size_t capacity;
+    size_t head = 0;  // next byte written
+    size_t tail = 0;  // oldest record
+    size_t used = 0;
+    size_t records = 0;
+    size_t droppedFrames = 0;
+    uint32_t lastUs = 0;
+    volatile bool saving = false;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+// Walks a saved capture. Times are accumulated from the deltas, starting
+// at 0.
+class McpCaptureReader {
+   public:
+    struct Frame {
+        uint8_t kind;
+        uint64_t timeUs;
+        const uint8_t* data;
+        size_t len;
+    };
+
+    McpCaptureReader(const uint8_t* data, size_t len);
+    // False if the header is missing or of another version.
+    bool valid() const { return ok; }
+    // False at the end or on a truncated record.
+    bool next(Frame& frame);
+
+   private:
+    bool readVarint(uint32_t& value);
+
+    const uint8_t* p;
+    const uint8_t* end;
+    uint64_t timeUs = 0;
+    bool ok;
+};
+
+#endif  // MCP_CAPTURE_H
@@ -0,0 +1,245 @@
+#ifndef MCP_SCHEMA_H
+#define MCP_SCHEMA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include <memory>
+
+// Compile-time JSON Schema DSL.
+//
+// Every macro expands to a string literal, so a whole schema is assembled by
+// the compiler through literal concatenation and ends up as a single constant
+// in flash. Nothing is allocated or built at runtime.
+//
+//   MCP_SCHEMA_OBJECT(
+//       MCP_SCHEMA_PROPERTIES(
+//           MCP_SCHEMA_PROPERTY("ssid", MCP_SCHEMA_STRING("WiFi SSID")),
+//           MCP_SCHEMA_PROPERTY("password", MCP_SCHEMA_STRING("WiFi password"))),
+//       MCP_SCHEMA_REQUIRED("ssid", "password"))
+//
+// Keyword macros (MCP_SCHEMA_TYPE, MCP_SCHEMA_PROPERTIES, ...) produce
+// `"key":value` fragments; MCP_SCHEMA(...) wraps fragments into an object.
+// Lists accept up to 16 entries. Text arguments are inserted verbatim and must
+// already be JSON-escaped.
+
+#define MCP_SCHEMA_CAT_(a, b) a##b
+#define MCP_SCHEMA_CAT(a, b) MCP_SCHEMA_CAT_(a, b)
+#define MCP_SCHEMA_NARG_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ...) N
+#define MCP_SCHEMA_NARG(...) \
+    MCP_SCHEMA_NARG_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+
+// Joins fragments with commas.
+#define MCP_SCHEMA_JOIN(...) MCP_SCHEMA_CAT(MCP_SCHEMA_JOIN_, MCP_SCHEMA_NARG(__VA_ARGS__))(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_1(a) a
+#define MCP_SCHEMA_JOIN_2(a, ...) a "," MCP_SCHEMA_JOIN_1(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_3(a, ...) a "," MCP_SCHEMA_JOIN_2(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_4(a, ...) a "," MCP_SCHEMA_JOIN_3(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_5(a, ...) a "," MCP_SCHEMA_JOIN_4(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_6(a, ...) a "," MCP_SCHEMA_JOIN_5(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_7(a, ...) a "," MCP_SCHEMA_JOIN_6(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_8(a, ...) a "," MCP_SCHEMA_JOIN_7(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_9(a, ...) a "," MCP_SCHEMA_JOIN_8(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_10(a, ...) a "," MCP_SCHEMA_JOIN_9(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_11(a, ...) a "," MCP_SCHEMA_JOIN_10(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_12(a, ...) a "," MCP_SCHEMA_JOIN_11(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_13(a, ...) a "," MCP_SCHEMA_JOIN_12(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_14(a, ...) a "," MCP_SCHEMA_JOIN_13(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_15(a, ...) a "," MCP_SCHEMA_JOIN_14(__VA_ARGS__)
+#define MCP_SCHEMA_JOIN_16(a, ...) a "," MCP_SCHEMA_JOIN_15(__VA_ARGS__)
+
+// Quotes each argument and joins them with commas.
+#define MCP_SCHEMA_QUOTE(...) MCP_SCHEMA_CAT(MCP_SCHEMA_QUOTE_, MCP_SCHEMA_NARG(__VA_ARGS__))(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_1(a) "\"" a "\""
+#define MCP_SCHEMA_QUOTE_2(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_1(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_3(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_2(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_4(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_3(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_5(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_4(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_6(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_5(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_7(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_6(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_8(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_7(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_9(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_8(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_10(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_9(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_11(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_10(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_12(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_11(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_13(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_12(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_14(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_13(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_15(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_14(__VA_ARGS__)
+#define MCP_SCHEMA_QUOTE_16(a, ...) "\"" a "\"," MCP_SCHEMA_QUOTE_15(__VA_ARGS__)
+
+// Schema object from keyword fragments.
+#define MCP_SCHEMA(...) "{" MCP_SCHEMA_JOIN(__VA_ARGS__) "}"
+
+// Keyword fragments.
+#define MCP_SCHEMA_TYPE(type) "\"type\":\"" type "\""
+#define MCP_SCHEMA_TITLE(text) "\"title\":\"" text "\""
+#define MCP_SCHEMA_DESCRIPTION(text) "\"description\":\"" text "\""
+#define MCP_SCHEMA_FORMAT(format) "\"format\":\"" format "\""
+#define MCP_SCHEMA_DEFAULT(json) "\"default\":" json
+#define MCP_SCHEMA_PROPERTY(key, schema) "\"" key "\":" schema
+#define MCP_SCHEMA_PROPERTIES(...) "\"properties\":{" MCP_SCHEMA_JOIN(__VA_ARGS__) "}"
+#define MCP_SCHEMA_REQUIRED(...) "\"required\":[" MCP_SCHEMA_QUOTE(__VA_ARGS__) "]"
+#define MCP_SCHEMA_ADDITIONAL_PROPERTIES(allowed) "\"additionalProperties\":" #allowed
+#define MCP_SCHEMA_ITEMS(schema) "\"items\":" schema
+#define MCP_SCHEMA_ENUM(...) "\"enum\":[" MCP_SCHEMA_QUOTE(__VA_ARGS__) "]"
+#define MCP_SCHEMA_ONE_OF(...) "\"oneOf\":[" MCP_SCHEMA_JOIN(__VA_ARGS__) "]"
+#define MCP_SCHEMA_ANY_OF(...) "\"anyOf\":[" MCP_SCHEMA_JOIN(__VA_ARGS__) "]"
+#define MCP_SCHEMA_ALL_OF(...) "\"allOf\":[" MCP_SCHEMA_JOIN(__VA_ARGS__) "]"
+
+// Shorthands for the common cases.
+#define MCP_SCHEMA_STRING(description) MCP_SCHEMA(MCP_SCHEMA_TYPE("string"), MCP_SCHEMA_DESCRIPTION(description))
+#define MCP_SCHEMA_NUMBER(description) MCP_SCHEMA(MCP_SCHEMA_TYPE("number"), MCP_SCHEMA_DESCRIPTION(description))
+#define MCP_SCHEMA_INTEGER(description) MCP_SCHEMA(MCP_SCHEMA_TYPE("integer"), MCP_SCHEMA_DESCRIPTION(description))
+#define MCP_SCHEMA_BOOLEAN(description) MCP_SCHEMA(MCP_SCHEMA_TYPE("boolean"), MCP_SCHEMA_DESCRIPTION(description))
+#define MCP_SCHEMA_ARRAY(description, items) \
+    MCP_SCHEMA(MCP_SCHEMA_TYPE("array"), MCP_SCHEMA_DESCRIPTION(description), MCP_SCHEMA_ITEMS(items))
+#define MCP_SCHEMA_OBJECT(...) MCP_SCHEMA(MCP_SCHEMA_TYPE("object"), __VA_ARGS__)
+#define MCP_SCHEMA_EMPTY_OBJECT MCP_SCHEMA(MCP_SCHEMA_TYPE("object"))
+
+class Properties;
+
+// Flattened JSON Schema.
+//
+// A Properties tree is compiled once into a single arena holding a node array
+// in pre-order, index lists (required/enum) and an interned string pool. The
+// tree can then be dropped; serialization is a linear pass over the nodes.
+class FlatSchema {
+   public:
+    static const uint8_t MAX_DEPTH = 16;
+    static const uint16_t NONE = 0xFFFF;
+
+    enum Role : uint8_t { ROLE_ROOT, ROLE_PROPERTY, ROLE_ITEMS, ROLE_ONE_OF, ROLE_ANY_OF, ROLE_ALL_OF };
+
+    enum Flags : uint8_t {
+        HAS_PROPERTIES = 0x01,
+        HAS_ITEMS = 0x02,
+        HAS_ONE_OF = 0x04,
+        HAS_ANY_OF = 0x08,
+        HAS_ALL_OF = 0x10,
+        HAS_ADDITIONAL_PROPERTIES = 0x20,
+        ADDITIONAL_PROPERTIES = 0x40,
+    };
+
+    struct Node {
+        // Offsets into the string pool, NONE when absent.
+        uint16_t type;
+        uint16_t title;
+        uint16_t description;
+        uint16_t format;
+        uint16_t defaultValue;
+        uint16_t key;  // property name for ROLE_PROPERTY
+        uint16_t end;  // one past the last node of this subtree
+        uint16_t listStart;  // required names, then enum values
+        uint8_t requiredCount;
+        uint8_t enumCount;
+        uint8_t role;
+        uint8_t depth;
+        uint8_t flags;
+    };
+
+    FlatSchema() = default;
+    FlatSchema(const FlatSchema& other);
+    FlatSchema& operator=(const FlatSchema& other);
+    FlatSchema(FlatSchema&& other) noexcept;
+    FlatSchema& operator=(FlatSchema&& other) noexcept;
+
+    // Returns false if the tree is deeper than MAX_DEPTH or too large to index.
+    bool build(const Properties& schema);
+    // Same, from parsed schema JSON (e.g. a ToolDefinition). Also returns
+    // false if an "enum" or "required" entry is not a string, as the
+    // validator only matches strings.
+    bool build(JsonVariantConst schema);
+
+    bool empty() const { return nodeCount == 0; }
+    uint16_t size() const { return nodeCount; }
+    size_t memoryUsage() const { return arenaSize; }
+
+    const Node& node(uint16_t index) const { return nodes()[index]; }
+    const char* str(uint16_t offset) const { return offset == NONE ? nullptr : strings() + offset; }
+    const char* listStr(uint16_t index) const { return strings() + lists()[index]; }
+
+    // Strings are linked, not copied: the schema must outlive `obj`, unless
+    // `copyStrings` is set.
+    void toJson(JsonObject& obj, bool copyStrings = false) const;
+    String toString() const;
+
+   private:
+    const Node* nodes() const { return reinterpret_cast<const Node*>(arena.get()); }
+    const uint16_t* lists() const {
+        return reinterpret_cast<const uint16_t*>(arena.get() + nodeCount * sizeof(Node));
+    }
+    const char* strings() const {
+        return reinterpret_cast<const char*>(arena.get() + nodeCount * sizeof(Node) + listCount * sizeof(uint16_t));
+    }
+
+    std::unique_ptr<uint8_t[]> arena;
+    size_t arenaSize = 0;
+    uint16_t nodeCount = 0;
+    uint16_t listCount = 0;
+};
+
+// Input validator compiled from a FlatSchema.
+//
+// The program is a pre-order array of ops with JSON types resolved to a bit
+// mask, plus a pool holding only property names, required names and enum
+// values. Supports type, properties, required, additionalProperties, enum,
+// items, oneOf, anyOf and allOf. An empty validator accepts everything.
+class SchemaValidator {
+   public:
+    enum TypeMask : uint8_t {
+        TYPE_NULL = 0x01,
+        TYPE_BOOLEAN = 0x02,
+        TYPE_INTEGER = 0x04,
+        TYPE_NUMBER = 0x08,  // non-integral numbers; "number" also allows integers
+        TYPE_STRING = 0x10,
+        TYPE_ARRAY = 0x20,
+        TYPE_OBJECT = 0x40,
+    };
+
+    struct Op {
+        uint8_t types;  // 0 accepts any type
+        uint8_t flags;  // FlatSchema::Flags
+        uint8_t role;   // FlatSchema::Role
+        uint8_t requiredCount;
+        uint8_t enumCount;
+        uint16_t key;
+        uint16_t end;
+        uint16_t listStart;
+    };
+
+    struct Error {
+        char message[96];
+    };
+
+    SchemaValidator() = default;
+    SchemaValidator(const SchemaValidator& other);
+    SchemaValidator& operator=(const SchemaValidator& other);
+    SchemaValidator(SchemaValidator&& other) noexcept;
+    SchemaValidator& operator=(SchemaValidator&& other) noexcept;
+
+    void compile(const FlatSchema& schema);
+
+    // Missing arguments are checked as an empty object.
+    bool validate(JsonVariantConst arguments, Error& error) const;
+
+    bool empty() const { return opCount == 0; }
+    uint16_t size() const { return opCount; }
+    size_t memoryUsage() const { return arenaSize; }
+
+   private:
+    const Op* ops() const { return reinterpret_cast<const Op*>(arena.get()); }
+    const uint16_t* lists() const { return reinterpret_cast<const uint16_t*>(arena.get() + opCount * sizeof(Op)); }
+    const char* strings() const {
+        return reinterpret_cast<const char*>(arena.get() + opCount * sizeof(Op) + listCount * sizeof(uint16_t));
+    }
+
+    bool validateOp(uint16_t index, JsonVariantConst value, const char* name, Error* error) const;
+    uint16_t findChild(uint16_t index, uint8_t role, const char* key) const;
+
+    std::unique_ptr<uint8_t[]> arena;
+    size_t arenaSize = 0;
+    uint16_t opCount = 0;
+    uint16_t listCount = 0;
+};
+
+#endif  // MCP_SCHEMA_H
@@ -0,0 +1,132 @@
+#ifndef MCP_TOOL_ARGS_H
+#define MCP_TOOL_ARGS_H
+
+#include <stddef.h>
+
+#include "BLEMCPServer.h"
+
+// Typed tool arguments.
+//
+// A plain struct describes the arguments of a tool; MCP_TOOL_ARGS lists its
+// fields once, and both the input schema and the decoding are derived from
+// that list:
+//
+//   struct WifiArgs {
+//       const char* ssid;
+//       const char* password;
+//   };
+//   MCP_TOOL_ARGS(WifiArgs,
+//                 MCP_ARG(WifiArgs, ssid, "WiFi SSID"),
+//                 MCP_ARG(WifiArgs, password, "WiFi password"));
+//
+//   class ConfigWifiHandler : public TypedToolHandler<WifiArgs> {
+//       DynamicJsonDocument call(const WifiArgs& args) override;
+//   };
+//
+//   tool.inputSchema = ConfigWifiHandler::inputSchema();
+//
+// Supported field types: bool, int, long, float, double, const char* and
+// String. `const char*` fields point into the request and are only valid
+// during call(). Fields bound with MCP_OPTIONAL_ARG are not required, and
+// keep their default value when absent. An integer that does not fit its
+// int or long field rejects the call with INVALID_PARAMS.
+
+enum class ToolArgType : uint8_t { BOOL, INT, LONG, FLOAT, DOUBLE, C_STRING, STRING };
+
+struct ToolArgField {
+    const char* name;
+    const char* description;
+    ToolArgType type;
+    size_t offset;
+    bool required;
+};
+
+template <typename T>
+struct ToolArgTypeOf;
+template <>
+struct ToolArgTypeOf<bool> {
+    static constexpr ToolArgType value = ToolArgType::BOOL;
+};
+template <>
+struct ToolArgTypeOf<int> {
+    static constexpr ToolArgType value = ToolArgType::INT;
+};
+template <>
+struct ToolArgTypeOf<long> {
+    static constexpr ToolArgType value = ToolArgType::LONG;
+};
+template <>
+struct ToolArgTypeOf<float> {
+    static constexpr ToolArgType value = ToolArgType::FLOAT;
+};
+template <>
+struct ToolArgTypeOf<double> {
+    static constexpr ToolArgType value = ToolArgType::DOUBLE;
+};
+template <>
+struct ToolArgTypeOf<const char*> {
+    static constexpr ToolArgType value = ToolArgType::C_STRING;
+};
+template <>
+struct ToolArgTypeOf<String> {
+    static constexpr ToolArgType value = ToolArgType::STRING;
+};
+
+// Specialized by MCP_TOOL_ARGS.
+template <typename Args>
+struct ToolArgs;
+
+#define MCP_ARG(Type, member, description) \
+    { #member, description, ToolArgTypeOf<decltype(Type::member)>::value, offsetof(Type, member), true }
+#define MCP_OPTIONAL_ARG(Type, member, description) \
+    { #member, description, ToolArgTypeOf<decltype(Type::member)>::value, offsetof(Type, member), false }
+
+#define MCP_TOOL_ARGS(Type, ...)                                           \
+    template <>                                                           \
+    struct ToolArgs<Type> {                                               \
+        static const ToolArgField* fields(size_t& count) {                \
+            static const ToolArgField list[] = {__VA_ARGS__};             \
+            count = sizeof(list) / sizeof(list[0]);                       \
+            return list;                                                  \
+        }                                                                 \
+    }
+
+// Single pass over the argument members; unknown members are ignored.
+void decodeToolArgs(JsonVariantConst arguments, const ToolArgField* fields, size_t count, void* out);
+// False, with the field named in `error`, if an integer member does not fit
+// its field. The schema only says "integer".
+bool checkToolArgs(JsonVariantConst arguments, const ToolArgField* fields, size_t count,
+                   SchemaValidator::Error& error);
+Properties buildToolArgsSchema(const ToolArgField* fields, size_t count);
+
+template <typename Args>
+class TypedToolHandler : public ToolHandler {
+   public:
+    virtual DynamicJsonDocument call(const Args& args) = 0;
+
+    DynamicJsonDocument call(const DynamicJsonDocument& params) override {
+        return invoke(params.as<JsonVariantConst>());
+    }
+
+    DynamicJsonDocument invoke(JsonVariantConst arguments) override {
+        size_t count = 0;
+        const ToolArgField* fields = ToolArgs<Args>::fields(count);
+        Args args = Args();
+        decodeToolArgs(arguments, fields, count, &args);
+        return call(args);
+    }
+
+    bool checkArguments(JsonVariantConst arguments, SchemaValidator::Error& error) override {
+        size_t count = 0;
+        const ToolArgField* fields = ToolArgs<Args>::fields(count);
+        return checkToolArgs(arguments, fields, count, error);
+    }
+
+    static Properties inputSchema() {
+        size_t count = 0;
+        const ToolArgField* fields = ToolArgs<Args>::fields(count);
+        return buildToolArgsSchema(fields, count);
+    }
+};
+
+#endif  // MCP_TOOL_ARGS_H
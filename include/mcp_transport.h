@@ -12,6 +12,12 @@ typedef void (*mcp_transport_message_cb_t)(const char *message, void *ctx);
 typedef void (*mcp_transport_sleep_fn_t)(uint32_t ticks, void *ctx);
 typedef void (*mcp_transport_log_fn_t)(int level, const char *tag, const char *message, void *ctx);
 typedef void (*mcp_transport_lock_fn_t)(bool lock, void *ctx);
+typedef void (*mcp_transport_trace_fn_t)(int event, size_t len, void *ctx);
+typedef void (*mcp_transport_capture_fn_t)(int kind, const uint8_t *data, size_t len, void *ctx);
+/* One received chunk of a blob; `offset` + `len` == `total_len` on the last
+ * one. `data` is NULL when the blob is abandoned (lost frame or overflow). */
+typedef void (*mcp_transport_blob_cb_t)(uint16_t blob_id, uint32_t total_len, uint32_t offset, const uint8_t *data,
+                                        size_t len, void *ctx);
 
 enum {
     MCP_TRANSPORT_LOG_ERROR = 1,
@@ -20,6 +26,25 @@ enum {
     MCP_TRANSPORT_LOG_DEBUG = 4,
 };
 
+/* Trace events; `len` is the message length (for TX_END, 1 on success). */
+enum {
+    MCP_TRANSPORT_TRACE_RX_FIRST = 1, /* first fragment of a message */
+    MCP_TRANSPORT_TRACE_TX_BEGIN = 2, /* transport lock taken */
+    MCP_TRANSPORT_TRACE_TX_END = 3,   /* last packet handed to the radio */
+};
+
+/* Capture events: every packet received, every packet sent (after retries),
+ * MTU changes, whose `data` is the new MTU as 2 bytes big-endian, and
+ * connects and disconnects, which carry no data. */
+enum {
+    MCP_TRANSPORT_CAPTURE_RX = 1,
+    MCP_TRANSPORT_CAPTURE_TX = 2,
+    MCP_TRANSPORT_CAPTURE_TX_FAILED = 3,
+    MCP_TRANSPORT_CAPTURE_MTU = 4,
+    MCP_TRANSPORT_CAPTURE_CONNECT = 5,
+    MCP_TRANSPORT_CAPTURE_DISCONNECT = 6,
+};
+
 void mcp_transport_init(void);
 void mcp_transport_deinit(void);
 void mcp_transport_set_send_fn(mcp_transport_send_fn_t fn, void *ctx);
@@ -27,11 +52,37 @@ void mcp_transport_set_message_cb(mcp_transport_message_cb_t cb, void *ctx);
 void mcp_transport_set_sleep_fn(mcp_transport_sleep_fn_t fn, void *ctx);
 void mcp_transport_set_log_fn(mcp_transport_log_fn_t fn, void *ctx);
 void mcp_transport_set_lock_fn(mcp_transport_lock_fn_t fn, void *ctx);
+void mcp_transport_set_trace_fn(mcp_transport_trace_fn_t fn, void *ctx);
+void mcp_transport_set_capture_fn(mcp_transport_capture_fn_t fn, void *ctx);
+void mcp_transport_set_blob_cb(mcp_transport_blob_cb_t cb, void *ctx);
 void mcp_transport_set_mtu(uint16_t mtu);
+void mcp_transport_connection_changed(bool connected);
 void mcp_transport_set_tx_gap_ticks(uint32_t gap_ticks);
 void mcp_transport_set_send_retry(uint8_t max_retries, uint32_t retry_delay_ticks);
 void mcp_transport_receive(const uint8_t *data, size_t len);
-void mcp_transport_send_message(const char *json_message);
+bool mcp_transport_send_message(const char *json_message);
+
+/* Sends one message of known length incrementally, without buffering it.
+ * Packets are filled to the MTU and go out as soon as they are full; the
+ * total may exceed the single-message limit of mcp_transport_send_message.
+ * begin() holds the transport lock until end(). */
+bool mcp_transport_stream_begin(size_t total_len);
+bool mcp_transport_stream_write(const uint8_t *data, size_t len);
+bool mcp_transport_stream_end(void);
+/* Gives up on the stream begun last and releases the lock. The packets sent
+ * so far form an incomplete message, which the receiver drops when the next
+ * message starts. */
+void mcp_transport_stream_abort(void);
+
+/* Blob frames carry raw bytes outside the JSON framing: a SINGLE packet
+ * whose payload starts with a NUL byte, which no JSON message does:
+ *
+ *   [SINGLE|seq] 0x00 flags id(2) [total(4) if flags & FIRST] data...
+ *
+ * Every packet of a blob is one such frame, so blobs are neither buffered
+ * nor bound by the message size limit. Sends `total_len` bytes as blob
+ * `blob_id` through mcp_transport_stream_write() and _end(). */
+bool mcp_transport_blob_begin(uint16_t blob_id, size_t total_len);
 
 #ifdef __cplusplus
 }
@@ -1,99 +1,350 @@
 #include "BLEMCPServer.h"
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <algorithm>
+#include <new>
 #include "McpBle.h"
 #include "mcp_transport.h"
 #include "esp_log.h"
 
 #define TAG "MCP_SERVER"
 
-BLEMCPServer* BLEMCPServer::s_bound = nullptr;
-bool BLEMCPServer::s_initialized = false;
-
-String Properties::toString() const {
-    DynamicJsonDocument doc(4096);
-    JsonObject obj = doc.to<JsonObject>();
-    toJson(obj);
-    String result;
-    serializeJson(doc, result);
-    return result;
+static uint32_t mcpHashString(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
 }
 
-void Properties::toJson(JsonObject& obj) const {
-    obj["type"] = type;
-
-    if (title.length() > 0) {
-        obj["title"] = title;
+static const char kBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t base64Encode(const uint8_t* in, size_t len, char* out) {
+    size_t o = 0;
+    size_t i = 0;
+    for (; i + 2 < len; i += 3) {
+        uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+        out[o++] = kBase64Alphabet[(v >> 18) & 0x3F];
+        out[o++] = kBase64Alphabet[(v >> 12) & 0x3F];
+        out[o++] = kBase64Alphabet[(v >> 6) & 0x3F];
+        out[o++] = kBase64Alphabet[v & 0x3F];
+    }
+    if (i < len) {
+        uint32_t v = in[i] << 16;
+        if (i + 1 < len) v |= in[i + 1] << 8;
+        out[o++] = kBase64Alphabet[(v >> 18) & 0x3F];
+        out[o++] = kBase64Alphabet[(v >> 12) & 0x3F];
+        out[o++] = (i + 1 < len) ? kBase64Alphabet[(v >> 6) & 0x3F] : '=';
+        out[o++] = '=';
     }
+    return o;
+}
 
-    if (description.length() > 0) {
-        obj["description"] = description;
+// Writes the JSON string escape of `c` to `out` (up to 6 bytes).
+static size_t jsonEscape(uint8_t c, char* out) {
+    switch (c) {
+        case '"':
+        case '\\':
+            out[0] = '\\';
+            out[1] = (char)c;
+            return 2;
+        case '\n':
+            out[0] = '\\';
+            out[1] = 'n';
+            return 2;
+        case '\r':
+            out[0] = '\\';
+            out[1] = 'r';
+            return 2;
+        case '\t':
+            out[0] = '\\';
+            out[1] = 't';
+            return 2;
+        default:
+            if (c < 0x20) {
+                snprintf(out, 7, "\\u%04x", c);
+                return 6;
+            }
+            out[0] = (char)c;
+            return 1;
     }
+}
 
-    if (!properties.empty()) {
-        JsonObject propertiesObj = obj["properties"].to<JsonObject>();
-        for (const auto& kv : properties) {
-            const String& key = kv.first;
-            const Properties& value = kv.second;
-            JsonObject propObj = propertiesObj[key].to<JsonObject>();
-            value.toJson(propObj);
-        }
+static void appendEscaped(std::string& out, const char* text) {
+    char escaped[7];
+    for (; *text; text++) {
+        out.append(escaped, jsonEscape((uint8_t)*text, escaped));
     }
+}
 
-    if (!required.empty()) {
-        JsonArray requiredArray = obj["required"].to<JsonArray>();
-        for (const auto& req : required) {
-            requiredArray.add(req);
-        }
+// Reads until `len` bytes or the end of the resource.
+static size_t readResource(ResourceProvider& provider, size_t offset, uint8_t* buffer, size_t len) {
+    size_t filled = 0;
+    while (filled < len) {
+        size_t n = provider.read(offset + filled, buffer + filled, len - filled);
+        if (n == 0) break;
+        filled += n;
     }
+    return filled;
+}
+
+static bool isUtf8Continuation(uint8_t c) {
+    return (c & 0xC0) == 0x80;
+}
+
+// Start of the UTF-8 character `pos` falls in. Left alone when the bytes
+// before it are not valid UTF-8.
+static size_t utf8CharStart(ResourceProvider& provider, size_t pos) {
+    uint8_t window[4];
+    size_t back = pos < 3 ? pos : 3;
+    size_t n = readResource(provider, pos - back, window, back + 1);
+    if (n <= back || !isUtf8Continuation(window[back])) return pos;
+    size_t i = back;
+    while (i > 0 && isUtf8Continuation(window[i])) i--;
+    return isUtf8Continuation(window[i]) ? pos : pos - back + i;
+}
 
-    if (hasAdditionalProperties) {
-        obj["additionalProperties"] = additionalProperties;
+// First character boundary at or after `pos`.
+static size_t utf8NextStart(ResourceProvider& provider, size_t pos) {
+    uint8_t window[4];
+    size_t n = readResource(provider, pos, window, sizeof(window));
+    size_t i = 0;
+    while (i < n && i < 3 && isUtf8Continuation(window[i])) i++;
+    return pos + i;
+}
+
+// FNV-1a, continued over a range read in pieces.
+static uint32_t hashBytes(uint32_t h, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
     }
+    return h;
+}
+
+// Streams body bytes unless they would run past the announced length.
+static bool writeBody(const char* data, size_t len, size_t& left) {
+    if (len > left) return false;
+    mcp_transport_stream_write((const uint8_t*)data, len);
+    left -= len;
+    return true;
+}
+
+static const char* skipSpace(const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
 
-    if (items) {
-        JsonObject itemsObj = obj["items"].to<JsonObject>();
-        items->toJson(itemsObj);
+// `p` is at the opening quote; returns the position after the closing one.
+static const char* skipString(const char* p) {
+    for (p++; *p && *p != '"'; p++) {
+        if (*p == '\\' && p[1]) p++;
     }
+    return *p ? p + 1 : nullptr;
+}
 
-    if (!enumValues.empty()) {
-        JsonArray enumArray = obj["enum"].to<JsonArray>();
-        for (const auto& value : enumValues) {
-            enumArray.add(value);
+static const char* skipValue(const char* p) {
+    if (*p == '"') return skipString(p);
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        while (*p) {
+            if (*p == '"') {
+                p = skipString(p);
+                if (!p) return nullptr;
+                continue;
+            }
+            if (*p == '{' || *p == '[') {
+                depth++;
+            } else if ((*p == '}' || *p == ']') && --depth == 0) {
+                return p + 1;
+            }
+            p++;
         }
+        return nullptr;
     }
+    while (*p && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+    return p;
+}
+
+// Schema text of a ToolDefinition. tools/list inserts it raw, so it must be
+// exactly one JSON value: anything after it would corrupt the whole list.
+static bool parseSchemaText(const char* text, FlatSchema& schema) {
+    const char* end = skipValue(skipSpace(text));
+    if (!end || *skipSpace(end) != '\0') return false;
+    DynamicJsonDocument doc(strlen(text) * 2 + 256);
+    return !deserializeJson(doc, text) && schema.build(doc.as<JsonVariantConst>());
+}
 
-    if (!oneOf.empty()) {
-        JsonArray oneOfArray = obj["oneOf"].to<JsonArray>();
-        for (const auto& schema : oneOf) {
-            JsonObject schemaObj = oneOfArray.createNestedObject();
-            schema.toJson(schemaObj);
+// Locates the raw text of a member of the object at `json` without parsing
+// it. Nested values and strings are skipped, so a key inside them never
+// matches. Used to route messages before the full parse.
+static bool findMember(const char* json, const char* key, const char*& value, size_t& len) {
+    const char* p = skipSpace(json);
+    if (*p != '{') return false;
+    size_t keyLen = strlen(key);
+    p = skipSpace(p + 1);
+    while (*p == '"') {
+        const char* name = p + 1;
+        p = skipString(p);
+        if (!p) return false;
+        bool match = (size_t)(p - 1 - name) == keyLen && memcmp(name, key, keyLen) == 0;
+        p = skipSpace(p);
+        if (*p != ':') return false;
+        p = skipSpace(p + 1);
+        const char* end = skipValue(p);
+        if (!end || end == p) return false;
+        if (match) {
+            value = p;
+            len = end - p;
+            return true;
         }
+        p = skipSpace(end);
+        if (*p != ',') return false;
+        p = skipSpace(p + 1);
     }
+    return false;
+}
 
-    if (!anyOf.empty()) {
-        JsonArray anyOfArray = obj["anyOf"].to<JsonArray>();
-        for (const auto& schema : anyOf) {
-            JsonObject schemaObj = anyOfArray.createNestedObject();
-            schema.toJson(schemaObj);
+// As findMember, for string values; `value` excludes the quotes and escapes
+// are left as they are.
+static bool findStringMember(const char* json, const char* key, const char*& value, size_t& len) {
+    if (!findMember(json, key, value, len) || *value != '"') return false;
+    value++;
+    len -= 2;
+    return true;
+}
+
+// Builds a result with `fill`, doubling the document while it overflows.
+// `capacity` starts from the last size that fit and is updated with it.
+template <typename Fill>
+static bool fillSized(DynamicJsonDocument& doc, size_t& capacity, size_t limit, Fill fill) {
+    size_t size = capacity < limit ? capacity : limit;
+    for (;;) {
+        doc = DynamicJsonDocument(size);
+        fill(doc);
+        if (!doc.overflowed()) {
+            capacity = size;
+            return true;
+        }
+        if (size >= limit) {
+            return false;
         }
+        size = size * 2 < limit ? size * 2 : limit;
     }
+}
 
-    if (!allOf.empty()) {
-        JsonArray allOfArray = obj["allOf"].to<JsonArray>();
-        for (const auto& schema : allOf) {
-            JsonObject schemaObj = allOfArray.createNestedObject();
-            schema.toJson(schemaObj);
-        }
+// Larger argument sets are not cached; they also bound the key size.
+static const size_t kMaxCachedArguments = 256;
+// Request buffers grown past this are released after the request.
+static const size_t kRetainedBufferBytes = 2048;
+// Smallest stack setTaskConfig() accepts: the server's own frames, before
+// any handler, need about this much.
+static const uint32_t kMinTaskStackBytes = 2048;
+
+BLEMCPServer* BLEMCPServer::s_bound = nullptr;
+bool BLEMCPServer::s_initialized = false;
+
+DynamicJsonDocument ToolHandler::invoke(JsonVariantConst arguments) {
+    DynamicJsonDocument argsDoc(arguments.memoryUsage() + 16);
+    argsDoc.set(arguments);
+    return call(argsDoc);
+}
+
+// A result too big for the server's document replaces it, so the document
+// grows to what this handler needs.
+bool ToolHandler::invokeInto(JsonVariantConst arguments, DynamicJsonDocument& result) {
+    DynamicJsonDocument doc = invoke(arguments);
+    if (doc.overflowed()) {
+        return false;
     }
+    if (!result.set(doc)) {
+        result = std::move(doc);
+    }
+    return true;
+}
+
+bool ToolHandler::checkArguments(JsonVariantConst arguments, SchemaValidator::Error& error) {
+    (void)arguments;
+    (void)error;
+    return true;
+}
 
-    if (format.length() > 0) {
-        obj["format"] = format;
+// Handler invocations, packaged for runTool().
+struct InvokeCall {
+    ToolHandler* handler;
+    JsonVariantConst arguments;
+    DynamicJsonDocument* result;
+    bool ok;
+    static void run(void* p) {
+        auto* call = static_cast<InvokeCall*>(p);
+        call->ok = call->handler->invokeInto(call->arguments, *call->result);
     }
+};
+
+struct StreamBeginCall {
+    StreamingToolHandler* handler;
+    JsonVariantConst arguments;
+    size_t size;
+    bool ok;
+    static void run(void* p) {
+        auto* call = static_cast<StreamBeginCall*>(p);
+        call->ok = call->handler->begin(call->arguments, call->size);
+    }
+};
+
+struct StreamChunkCall {
+    StreamingToolHandler* handler;
+    const uint8_t* data;
+    size_t len;
+    bool ok;
+    static void run(void* p) {
+        auto* call = static_cast<StreamChunkCall*>(p);
+        call->ok = call->handler->chunk(call->data, call->len);
+    }
+};
+
+struct StreamEndCall {
+    StreamingToolHandler* handler;
+    bool complete;
+    DynamicJsonDocument* result;
+    bool ok;
+    static void run(void* p) {
+        auto* call = static_cast<StreamEndCall*>(p);
+        call->ok = call->handler->end(call->complete, *call->result);
+    }
+};
+
+DynamicJsonDocument StreamingToolHandler::call(const DynamicJsonDocument&) {
+    DynamicJsonDocument doc(64);
+    doc["error"] = "Streaming tool";
+    return doc;
+}
+
+String Properties::toString() const {
+    DynamicJsonDocument doc(4096);
+    JsonObject obj = doc.to<JsonObject>();
+    toJson(obj);
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
 
-    if (defaultValue.length() > 0) {
-        obj["default"] = defaultValue;
+const FlatSchema& Properties::flat() const {
+    if (!flatCache) {
+        std::shared_ptr<FlatSchema> schema(new FlatSchema());
+        if (!schema->build(*this)) {
+            Serial.printf("Schema too deep or too large to flatten\n");
+        }
+        flatCache = schema;
     }
+    return *flatCache;
+}
+
+void Properties::toJson(JsonObject& obj) const {
+    // Serialized from the flat form, like registered tools in tools/list.
+    // The document may outlive this tree, so strings are copied into it.
+    const FlatSchema& schema = flat();
+    if (schema.empty()) return;
+    schema.toJson(obj, true);
 }
 
 String Tool::toString() const {
@@ -118,6 +369,9 @@ String Tool::toString() const {
 
 BLEMCPServer::BLEMCPServer(const String& name, const String& version, const String& instructions)
     : serverName(name), serverVersion(version), serverInstructions(instructions) {
+    setBusyRetryAfter(500);
+    tools_lock = xSemaphoreCreateMutex();
+    blob_lock = xSemaphoreCreateMutex();
 }
 
 void BLEMCPServer::begin() {
@@ -127,19 +381,29 @@ void BLEMCPServer::begin() {
     }
     s_bound = this;
 
-    if (!rx_queue) {
-        rx_queue = xQueueCreate(4, sizeof(char*));
+    if (!rx_ready) {
+        for (auto& queue : rx_queues) {
+            queue = xQueueCreate(queueDepth, sizeof(char*));
+        }
+        rxSlotSize = (rxSlotSize + 3) & ~(size_t)3;  // RxMessage alignment
+        rxSlots = rxSlotCount && rxSlotSize ? (uint8_t*)malloc(rxSlotCount * rxSlotSize) : nullptr;
+        rxSlotsFree = !rxSlots ? 0 : rxSlotCount == 32 ? 0xFFFFFFFFu : (1u << rxSlotCount) - 1;
+        rx_ready = xSemaphoreCreateCounting(CLASS_COUNT * queueDepth + 4, 0);
     }
-    if (!task_handle) {
-        xTaskCreate(BLEMCPServer::taskEntry, "mcp_ble_rx", 4096, this, 1, &task_handle);
+    if (!tx_lock) {
+        // Recursive: rejectBusy() holds it around a whole send.
+        tx_lock = xSemaphoreCreateRecursiveMutex();
     }
 
     mcp_transport_set_sleep_fn(BLEMCPServer::sleepTicks, NULL);
+    mcp_transport_set_lock_fn(BLEMCPServer::lockFn, this);
+    mcp_transport_set_trace_fn(BLEMCPServer::traceFn, this);
 
     if (!s_initialized) {
         mcp_transport_init();
         mcp_transport_set_send_fn(BLEMCPServer::sendBytes, NULL);
         mcp_transport_set_message_cb(BLEMCPServer::onMessage, this);
+        mcp_transport_set_blob_cb(BLEMCPServer::onBlob, this);
         mcp_transport_set_tx_gap_ticks(1);
         mcp_transport_set_send_retry(3, 1);
 
@@ -149,6 +413,7 @@ void BLEMCPServer::begin() {
         });
         
         McpBle::getInstance().setMtuCallback(BLEMCPServer::onMtu);
+        McpBle::getInstance().setConnectionCallback(BLEMCPServer::onConnection);
         mcp_transport_set_mtu(McpBle::getInstance().getMtu());
         
         McpBle::getInstance().init();
@@ -159,48 +424,292 @@ void BLEMCPServer::begin() {
         s_initialized = true;
     } else {
         mcp_transport_set_message_cb(BLEMCPServer::onMessage, this);
+        mcp_transport_set_blob_cb(BLEMCPServer::onBlob, this);
+    }
+
+    // Last: the dispatch task sends notifications and polls the link, so
+    // tx_lock, the transport hooks and the transport must be ready first.
+    // Messages received meanwhile wait in the queues.
+    if (!tool_task && toolTask.stackBytes > 0) {
+        tool_start = xSemaphoreCreateBinary();
+        tool_done = xSemaphoreCreateBinary();
+        if (!tool_start || !tool_done ||
+            xTaskCreatePinnedToCore(BLEMCPServer::toolTaskEntry, "mcp_tool", toolTask.stackBytes, this,
+                                    toolTask.priority, &tool_task, toolTask.core) != pdPASS) {
+            // Handlers then run on the dispatch task, as without a tool task.
+            Serial.printf("Tool task not created (%lu bytes on core %ld), running tools inline\n",
+                          (unsigned long)toolTask.stackBytes, (long)toolTask.core);
+            if (tool_start) vSemaphoreDelete(tool_start);
+            if (tool_done) vSemaphoreDelete(tool_done);
+            tool_start = tool_done = nullptr;
+            tool_task = nullptr;
+            toolTask.stackBytes = 0;
+        }
+    }
+    if (!task_handle &&
+        xTaskCreatePinnedToCore(BLEMCPServer::taskEntry, "mcp_ble_rx", dispatchTask.stackBytes, this,
+                                dispatchTask.priority, &task_handle, dispatchTask.core) != pdPASS) {
+        Serial.printf("Dispatch task not created (%lu bytes on core %ld), call loop() to serve requests\n",
+                      (unsigned long)dispatchTask.stackBytes, (long)dispatchTask.core);
+        task_handle = nullptr;
     }
 }
 
 void BLEMCPServer::loop() {
-    if (!rx_queue) return;
-    while (true) {
-        char* msg = nullptr;
-        if (xQueueReceive(rx_queue, &msg, 0) != pdTRUE) break;
-        if (msg) {
-            processMessage(msg);
-            free(msg);
-        }
+    if (!rx_ready) return;
+    while (RxMessage* msg = takeMessage()) {
+        processMessage(msg);
+        freeMessage(msg);
     }
+    drainInput();
+    flushNotifications();
+    McpBle::getInstance().pollLink(millis());
 }
 
 void BLEMCPServer::taskEntry(void* ctx) {
     auto* self = static_cast<BLEMCPServer*>(ctx);
     for (;;) {
-        if (!self || !self->rx_queue) {
+        if (!self || !self->rx_ready) {
             vTaskDelay(10 / portTICK_PERIOD_MS);
             continue;
         }
-        char* msg = nullptr;
-        if (xQueueReceive(self->rx_queue, &msg, portMAX_DELAY) == pdTRUE && msg) {
-            self->processMessage(msg);
-            free(msg);
+        // A count without a message only wakes the task to send
+        // notifications or take stream input.
+        uint32_t inputMs = self->drainInput();
+        TickType_t wait = self->flushNotifications();
+        uint32_t linkMs = McpBle::getInstance().pollLink(millis());
+        if (linkMs != UINT32_MAX && pdMS_TO_TICKS(linkMs) + 1 < wait) {
+            wait = pdMS_TO_TICKS(linkMs) + 1;
+        }
+        if (inputMs != UINT32_MAX && pdMS_TO_TICKS(inputMs) + 1 < wait) {
+            wait = pdMS_TO_TICKS(inputMs) + 1;
+        }
+        if (xSemaphoreTake(self->rx_ready, wait) == pdTRUE) {
+            RxMessage* msg = self->takeMessage();
+            if (msg) {
+                self->processMessage(msg);
+                self->freeMessage(msg);
+            }
+        }
+    }
+}
+
+void BLEMCPServer::toolTaskEntry(void* ctx) {
+    auto* self = static_cast<BLEMCPServer*>(ctx);
+    for (;;) {
+        if (xSemaphoreTake(self->tool_start, portMAX_DELAY) == pdTRUE) {
+            self->toolJob(self->toolJobArg);
+            xSemaphoreGive(self->tool_done);
         }
     }
 }
 
+void BLEMCPServer::runTool(void (*fn)(void*), void* arg) {
+    if (!tool_task) {
+        fn(arg);
+        return;
+    }
+    toolJob = fn;
+    toolJobArg = arg;
+    xSemaphoreGive(tool_start);
+    xSemaphoreTake(tool_done, portMAX_DELAY);
+}
+
+// Stacks below kMinTaskStackBytes and priorities past the scheduler's are
+// raised or lowered to the nearest usable value; a tool stack of 0 still
+// means no tool task.
+void BLEMCPServer::setTaskConfig(TaskStage stage, const TaskConfig& config) {
+    bool tool = stage == TaskStage::TOOL;
+    if (tool ? tool_task != nullptr : task_handle != nullptr) return;  // fixed once running
+    TaskConfig checked = config;
+    if (checked.stackBytes < kMinTaskStackBytes && !(tool && checked.stackBytes == 0)) {
+        Serial.printf("Task stack of %lu bytes raised to %lu\n", (unsigned long)checked.stackBytes,
+                      (unsigned long)kMinTaskStackBytes);
+        checked.stackBytes = kMinTaskStackBytes;
+    }
+    if (checked.priority >= configMAX_PRIORITIES) {
+        checked.priority = configMAX_PRIORITIES - 1;
+    }
+    (tool ? toolTask : dispatchTask) = checked;
+}
+
+TaskStats BLEMCPServer::getTaskStats(TaskStage stage) const {
+    TaskHandle_t handle = stage == TaskStage::TOOL ? tool_task : task_handle;
+    TaskStats stats = {};
+    stats.running = handle != nullptr;
+    const TaskConfig& config = stage == TaskStage::TOOL ? toolTask : dispatchTask;
+    stats.priority = config.priority;
+    stats.core = config.core;
+    stats.stackBytes = config.stackBytes;
+    if (handle) {
+        stats.stackFreeMin = uxTaskGetStackHighWaterMark(handle);
+    }
+    return stats;
+}
+
 void BLEMCPServer::onMessage(const char* message, void* ctx) {
     if (!ctx) return;
     auto* self = static_cast<BLEMCPServer*>(ctx);
-    if (!self->rx_queue || !message) return;
+    if (!self->rx_ready || !message) return;
+    uint16_t seq = ++self->rxSeq ? self->rxSeq : ++self->rxSeq;
+    uint32_t doneCycles = ESP.getCycleCount();
     size_t n = strlen(message);
-    char* copy = (char*)malloc(n + 1);
-    if (!copy) return;
-    memcpy(copy, message, n);
-    copy[n] = '\0';
-    if (xQueueSend(self->rx_queue, &copy, 0) != pdTRUE) {
-        free(copy);
+    self->trace(TraceStage::RX_FIRST, n, seq, self->rxStartCycles);
+    self->trace(TraceStage::RX_DONE, n, seq, doneCycles);
+
+    RequestClass cls = self->classify(message);
+    QueueHandle_t queue = self->rx_queues[cls];
+    if (uxQueueSpacesAvailable(queue) == 0) {
+        self->rejectBusy(message);
+        return;
+    }
+    RxMessage* copy = self->allocMessage(n);
+    if (!copy) {
+        self->rejectBusy(message);
+        return;
+    }
+    copy->rxDoneUs = micros();
+    copy->seq = seq;
+    memcpy(copy->text, message, n);
+    copy->text[n] = '\0';
+    if (xQueueSend(queue, &copy, 0) != pdTRUE) {
+        self->freeMessage(copy);
+        self->rejectBusy(message);
+        return;
+    }
+    xSemaphoreGive(self->rx_ready);
+
+    size_t waiting = uxQueueMessagesWaiting(queue);
+    portENTER_CRITICAL(&self->stats_mux);
+    self->queueStats.accepted++;
+    if (waiting > self->queueStats.peak[cls]) {
+        self->queueStats.peak[cls] = waiting;
+    }
+    portEXIT_CRITICAL(&self->stats_mux);
+}
+
+// A free slot when the message fits one, else a heap copy.
+BLEMCPServer::RxMessage* BLEMCPServer::allocMessage(size_t length) {
+    size_t size = offsetof(RxMessage, text) + length + 1;
+    if (size <= rxSlotSize) {
+        int slot = -1;
+        portENTER_CRITICAL(&stats_mux);
+        if (rxSlotsFree) {
+            slot = __builtin_ctz(rxSlotsFree);
+            rxSlotsFree &= ~(1u << slot);
+        }
+        portEXIT_CRITICAL(&stats_mux);
+        if (slot >= 0) {
+            return reinterpret_cast<RxMessage*>(rxSlots + slot * rxSlotSize);
+        }
+    }
+    return (RxMessage*)malloc(size);
+}
+
+void BLEMCPServer::freeMessage(RxMessage* message) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(message);
+    if (rxSlots && p >= rxSlots && p < rxSlots + rxSlotCount * rxSlotSize) {
+        size_t slot = (p - rxSlots) / rxSlotSize;
+        portENTER_CRITICAL(&stats_mux);
+        rxSlotsFree |= 1u << slot;
+        portEXIT_CRITICAL(&stats_mux);
+        return;
+    }
+    free(message);
+}
+
+// Answers on the receiving task, without queueing or parsing: the id is
+// copied from the message into the pre-serialized reply. The transport lock
+// is only waited on briefly since this runs in the BLE callback; if it stays
+// busy the request is dropped as before. Notifications get no reply.
+void BLEMCPServer::rejectBusy(const char* message) {
+    portENTER_CRITICAL(&stats_mux);
+    queueStats.rejected++;
+    portEXIT_CRITICAL(&stats_mux);
+
+    const char* id;
+    size_t idLen;
+    char reply[sizeof(busyTail) + 72];
+    static const char kHead[] = "{\"id\":";
+    if (!findMember(message, "id", id, idLen) || idLen > sizeof(reply) - sizeof(busyTail) - sizeof(kHead)) {
+        return;
+    }
+    memcpy(reply, kHead, sizeof(kHead) - 1);
+    memcpy(reply + sizeof(kHead) - 1, id, idLen);
+    strcpy(reply + sizeof(kHead) - 1 + idLen, busyTail);
+
+    if (tx_lock && xSemaphoreTakeRecursive(tx_lock, pdMS_TO_TICKS(20)) == pdTRUE) {
+        mcp_transport_send_message(reply);
+        xSemaphoreGiveRecursive(tx_lock);
+    }
+}
+
+// Protocol messages (initialize, lists, notifications, subscriptions) are
+// control; tools/call takes the tool's priority; resources/read streams and
+// is bulk; custom methods are interactive.
+BLEMCPServer::RequestClass BLEMCPServer::classify(const char* message) const {
+    const char* method;
+    size_t len;
+    if (!findStringMember(message, "method", method, len)) {
+        return CLASS_CONTROL;  // responses and garbage fail fast
+    }
+    char name[64];
+    if (len >= sizeof(name)) return CLASS_INTERACTIVE;
+    memcpy(name, method, len);
+    name[len] = '\0';
+
+    uint32_t hash = mcpHashString(name);
+    if (!isBuiltinMethod(name, hash)) {
+        return CLASS_INTERACTIVE;
+    }
+    switch (hash) {
+        case mcpHash("resources/read"):
+            return CLASS_BULK;
+        case mcpHash("tools/call"): {
+            const char* params;
+            const char* tool;
+            if (!findMember(message, "params", params, len) || !findStringMember(params, "name", tool, len) ||
+                len >= sizeof(name)) {
+                return CLASS_INTERACTIVE;
+            }
+            memcpy(name, tool, len);
+            name[len] = '\0';
+            ToolSnapshot tools(*this);
+            const ToolEntry* entry = tools.find(name);
+            return entry && entry->toolPriority() == ToolPriority::BULK ? CLASS_BULK : CLASS_INTERACTIVE;
+        }
+        default:
+            return CLASS_CONTROL;
+    }
+}
+
+// Highest non-empty class first. A class skipped kStarvationLimit times
+// while messages were waiting in it is served next, so bulk work still
+// progresses under a steady stream of small requests.
+BLEMCPServer::RxMessage* BLEMCPServer::takeMessage() {
+    static const uint8_t kStarvationLimit = 8;
+    int pick = -1;
+    for (int c = CLASS_COUNT - 1; c >= 0; c--) {
+        if (passedOver[c] >= kStarvationLimit && uxQueueMessagesWaiting(rx_queues[c]) > 0) {
+            pick = c;
+        }
     }
+    for (int c = 0; pick < 0 && c < CLASS_COUNT; c++) {
+        if (uxQueueMessagesWaiting(rx_queues[c]) > 0) {
+            pick = c;
+        }
+    }
+    if (pick < 0) return nullptr;
+
+    RxMessage* msg = nullptr;
+    if (xQueueReceive(rx_queues[pick], &msg, 0) != pdTRUE) return nullptr;
+    passedOver[pick] = 0;
+    for (int c = pick + 1; c < CLASS_COUNT; c++) {
+        if (uxQueueMessagesWaiting(rx_queues[c]) > 0 && passedOver[c] < kStarvationLimit) {
+            passedOver[c]++;
+        }
+    }
+    return msg;
 }
 
 int BLEMCPServer::sendBytes(const uint8_t* data, size_t len, void* ctx) {
@@ -223,64 +732,991 @@ void BLEMCPServer::logFn(int level, const char* tag, const char* message, void*
     Serial.printf("[%s] %s\n", tag, message);
 }
 
+void BLEMCPServer::lockFn(bool lock, void* ctx) {
+    auto* self = static_cast<BLEMCPServer*>(ctx);
+    if (!self || !self->tx_lock) return;
+    if (lock) {
+        xSemaphoreTakeRecursive(self->tx_lock, portMAX_DELAY);
+    } else {
+        xSemaphoreGiveRecursive(self->tx_lock);
+    }
+}
+
+void BLEMCPServer::traceFn(int event, size_t len, void* ctx) {
+    auto* self = static_cast<BLEMCPServer*>(ctx);
+    if (!self) return;
+    uint32_t cycles = ESP.getCycleCount();
+    switch (event) {
+        case MCP_TRANSPORT_TRACE_RX_FIRST:
+            // Recorded with the message's sequence number once complete.
+            self->rxStartCycles = cycles;
+            break;
+        case MCP_TRANSPORT_TRACE_TX_BEGIN:
+            self->trace(TraceStage::TX_BEGIN, len, self->traceRequest, cycles);
+            break;
+        case MCP_TRANSPORT_TRACE_TX_END:
+            self->trace(TraceStage::TX_END, len, self->traceRequest, cycles);
+            break;
+    }
+}
+
+void BLEMCPServer::trace(TraceStage stage, uint32_t arg, uint16_t request, uint32_t cycles) {
+    portENTER_CRITICAL(&stats_mux);
+    TraceRecord& record = traceRing[traceNext % MCP_TRACE_DEPTH];
+    traceNext++;
+    record.cycles = cycles;
+    record.arg = arg;
+    record.request = request;
+    record.stage = static_cast<uint8_t>(stage);
+    record.reserved = 0;
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+void BLEMCPServer::trace(TraceStage stage, uint32_t arg) {
+    trace(stage, arg, traceRequest, ESP.getCycleCount());
+}
+
+void BLEMCPServer::recordLatency(const MCPRequest& request, uint32_t elapsedUs) {
+    const char* method = request.method.c_str();
+    uint32_t hash = mcpHashString(method);
+    // Only known names get a histogram, so clients cannot grow the table.
+    if (!isBuiltinMethod(method, hash) && !findMethod(method, hash)) {
+        method = "(unknown)";
+    }
+    addLatency(method, false, elapsedUs);
+    if (strcmp(method, "tools/call") == 0) {
+        const char* tool = request.params()["name"];
+        if (tool && requestTools->find(tool)) {
+            addLatency(tool, true, elapsedUs);
+        }
+    }
+}
+
+void BLEMCPServer::addLatency(const char* name, bool tool, uint32_t elapsedUs) {
+    static const size_t kMaxEntries = 32;
+    uint32_t hash = mcpHashString(name);
+    LatencyStats* stats = nullptr;
+    for (auto& entry : latency) {
+        if (entry.hash == hash && entry.tool == tool && entry.name == name) {
+            stats = &entry;
+            break;
+        }
+    }
+    if (!stats) {
+        if (latency.size() >= kMaxEntries) return;
+        LatencyStats entry = {};
+        entry.hash = hash;
+        entry.tool = tool;
+        entry.name = name;
+        latency.push_back(std::move(entry));
+        stats = &latency.back();
+    }
+    size_t bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && elapsedUs >= (128u << bucket)) {
+        bucket++;
+    }
+    if (stats->buckets[bucket] < UINT16_MAX) stats->buckets[bucket]++;
+    stats->count++;
+    stats->totalUs += elapsedUs;
+    if (elapsedUs > stats->maxUs) stats->maxUs = elapsedUs;
+}
+
+void BLEMCPServer::onConnection(bool connected) {
+    mcp_transport_connection_changed(connected);
+    if (!connected) {
+        mcp_transport_set_mtu(23);
+    }
+    BLEMCPServer* self = s_bound;
+    if (!self) return;
+    // Subscriptions belong to the client session; a new session lists tools
+    // anyway.
+    portENTER_CRITICAL(&self->notify_mux);
+    for (auto& entry : self->resources) {
+        entry.subscribed = false;
+        entry.pending = false;
+        entry.notified = false;
+    }
+    self->toolsChanged = false;
+    portEXIT_CRITICAL(&self->notify_mux);
+    if (self->inputActive.load()) {
+        self->inputBroken.store(true);
+        self->wake();
+    }
+}
+
+bool BLEMCPServer::notify(const char* method, JsonVariantConst params) {
+    DynamicJsonDocument doc(256 + measureJson(params));
+    doc["jsonrpc"] = "2.0";
+    doc["method"] = method;
+    if (!params.isNull()) {
+        doc["params"] = params;
+    }
+    std::string message;
+    serializeJson(doc, message);
+    return mcp_transport_send_message(message.c_str());
+}
+
+void BLEMCPServer::notifyResourceUpdated(const String& uri) {
+    ResourceEntry* entry = findResource(uri.c_str());
+    if (!entry) return;
+    bool queued = false;
+    portENTER_CRITICAL(&notify_mux);
+    if (entry->subscribed) {
+        queued = !entry->pending;
+        entry->pending = true;
+    }
+    portEXIT_CRITICAL(&notify_mux);
+    if (queued) {
+        wake();
+    }
+}
+
+void BLEMCPServer::setNotificationInterval(uint32_t intervalMs) {
+    notificationIntervalMs = intervalMs;
+}
+
+void BLEMCPServer::setQueueDepth(size_t depth) {
+    queueDepth = depth > 0 ? depth : 1;
+}
+
+void BLEMCPServer::setReceiveSlots(size_t count, size_t bytes) {
+    if (rxSlots) return;  // fixed once begin() allocated them
+    rxSlotCount = count < 32 ? count : 32;
+    rxSlotSize = bytes;
+}
+
+void BLEMCPServer::setBlobLimits(size_t count, size_t bytes) {
+    xSemaphoreTake(blob_lock, portMAX_DELAY);
+    blobLimit = count;
+    blobBytesLimit = bytes;
+    rxBlobs.clear();
+    xSemaphoreGive(blob_lock);
+}
+
+// Runs on the BLE task for every blob frame. The buffer is allocated on the
+// first frame, from the size it announces, and filled in place.
+void BLEMCPServer::onBlob(uint16_t id, uint32_t total, uint32_t offset, const uint8_t* data, size_t len,
+                          void* ctx) {
+    auto* self = static_cast<BLEMCPServer*>(ctx);
+    if (!self) return;
+    if (self->inputActive.load(std::memory_order_acquire) && id == self->input.blobId) {
+        self->feedInput(offset, data, len);
+        return;
+    }
+    std::vector<BlobEntry>& blobs = self->rxBlobs;
+    xSemaphoreTake(self->blob_lock, portMAX_DELAY);
+    // adoptInput() may have started the stream while this frame waited.
+    if (self->inputActive.load(std::memory_order_acquire) && id == self->input.blobId) {
+        xSemaphoreGive(self->blob_lock);
+        self->feedInput(offset, data, len);
+        return;
+    }
+    auto it = blobs.begin();
+    while (it != blobs.end() && it->id != id) {
+        ++it;
+    }
+    if (offset == 0 && data) {
+        if (it != blobs.end()) {
+            blobs.erase(it);  // id reused
+        }
+        it = blobs.end();
+        if (self->blobLimit > 0 && total <= self->blobBytesLimit) {
+            size_t held = 0;
+            for (const BlobEntry& entry : blobs) {
+                held += entry.blob.size;
+            }
+            while (!blobs.empty() && (blobs.size() >= self->blobLimit || held + total > self->blobBytesLimit)) {
+                held -= blobs.front().blob.size;
+                blobs.erase(blobs.begin());
+            }
+            BlobEntry entry;
+            entry.id = id;
+            entry.received = 0;
+            entry.blob.size = total;
+            entry.blob.data.reset(new (std::nothrow) uint8_t[total ? total : 1]);
+            if (entry.blob.data) {
+                blobs.push_back(std::move(entry));
+                it = blobs.end() - 1;
+            }
+        }
+        if (it == blobs.end()) {
+            Serial.printf("Blob %u rejected: %lu bytes\n", (unsigned)id, (unsigned long)total);
+        }
+    }
+    if (it != blobs.end()) {
+        if (!data) {
+            blobs.erase(it);
+        } else {
+            memcpy(it->blob.data.get() + offset, data, len);
+            it->received += len;
+        }
+    }
+    xSemaphoreGive(self->blob_lock);
+}
+
+// Stream input on the BLE task: copied into the ring for drainInput(). More
+// than the credit allows, or a frame that does not follow the last one,
+// breaks the stream rather than blocking the stack.
+void BLEMCPServer::feedInput(uint32_t offset, const uint8_t* data, size_t len) {
+    uint32_t head = inputHead.load(std::memory_order_relaxed);
+    uint32_t tail = inputTail.load(std::memory_order_acquire);
+    if (!data || offset != head || len > inputWindow - (head - tail)) {
+        inputBroken.store(true);
+    } else {
+        size_t at = head % inputWindow;
+        size_t first = len < inputWindow - at ? len : inputWindow - at;
+        memcpy(inputRing.get() + at, data, first);
+        memcpy(inputRing.get(), data + first, len - first);
+        inputHead.store(head + len, std::memory_order_release);
+    }
+    wake();
+}
+
+bool BLEMCPServer::takeBlob(uint16_t id, McpBlob& blob) {
+    bool found = false;
+    xSemaphoreTake(blob_lock, portMAX_DELAY);
+    for (auto it = rxBlobs.begin(); it != rxBlobs.end(); ++it) {
+        if (it->id == id && it->received == it->blob.size) {
+            blob = std::move(it->blob);
+            rxBlobs.erase(it);
+            found = true;
+            break;
+        }
+    }
+    xSemaphoreGive(blob_lock);
+    return found;
+}
+
+uint16_t BLEMCPServer::beginBlob(size_t size) {
+    uint16_t id = ++txBlobId;
+    if (id == 0) {
+        id = ++txBlobId;
+    }
+    return mcp_transport_blob_begin(id, size) ? id : 0;
+}
+
+bool BLEMCPServer::writeBlob(const uint8_t* data, size_t len) {
+    return mcp_transport_stream_write(data, len);
+}
+
+bool BLEMCPServer::endBlob() {
+    return mcp_transport_stream_end();
+}
+
+void BLEMCPServer::setBusyRetryAfter(uint32_t retryAfterMs) {
+    snprintf(busyTail, sizeof(busyTail),
+             ",\"jsonrpc\":\"2.0\",\"error\":{\"code\":%d,\"message\":\"Server busy\",\"data\":{\"retryAfterMs\":%lu}}}",
+             static_cast<int>(ErrorCode::SERVER_BUSY), (unsigned long)retryAfterMs);
+}
+
+QueueStats BLEMCPServer::getQueueStats() const {
+    portENTER_CRITICAL(&stats_mux);
+    QueueStats stats = queueStats;
+    portEXIT_CRITICAL(&stats_mux);
+    stats.depth = queueDepth;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        stats.waiting[c] = rx_queues[c] ? uxQueueMessagesWaiting(rx_queues[c]) : 0;
+    }
+    return stats;
+}
+
+void BLEMCPServer::setMemoryBudget(size_t bytes) {
+    memoryBudget = bytes;
+}
+
+MemoryStats BLEMCPServer::getMemoryStats() const {
+    portENTER_CRITICAL(&stats_mux);
+    MemoryStats stats = memoryStats;
+    portEXIT_CRITICAL(&stats_mux);
+    stats.budget = memoryBudget;
+    return stats;
+}
+
+bool BLEMCPServer::chargeRequest(size_t bytes) {
+    requestBytes += bytes;
+    return requestBytes <= memoryBudget;
+}
+
+size_t BLEMCPServer::remainingBudget() const {
+    return requestBytes < memoryBudget ? memoryBudget - requestBytes : 0;
+}
+
+void BLEMCPServer::recordRequest(bool overBudget) {
+    portENTER_CRITICAL(&stats_mux);
+    totalRequestBytes += requestBytes;
+    memoryStats.requests++;
+    memoryStats.last = requestBytes;
+    if (requestBytes > memoryStats.peak) {
+        memoryStats.peak = requestBytes;
+    }
+    memoryStats.average = (size_t)(totalRequestBytes / memoryStats.requests);
+    if (overBudget) {
+        memoryStats.overBudget++;
+    }
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+void BLEMCPServer::wake() {
+    if (!rx_ready) return;
+    xSemaphoreGive(rx_ready);
+}
+
+TickType_t BLEMCPServer::flushNotifications() {
+    TickType_t wait = portMAX_DELAY;
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&notify_mux);
+    bool toolsDue = toolsChanged;
+    toolsChanged = false;
+    portEXIT_CRITICAL(&notify_mux);
+    if (toolsDue) {
+        notify("notifications/tools/list_changed");
+    }
+
+    for (auto& entry : resources) {
+        bool due = false;
+        portENTER_CRITICAL(&notify_mux);
+        if (entry.pending) {
+            uint32_t elapsed = now - entry.lastNotifyMs;
+            if (!entry.notified || elapsed >= notificationIntervalMs) {
+                entry.pending = false;
+                entry.notified = true;
+                entry.lastNotifyMs = now;
+                due = true;
+            } else {
+                TickType_t remaining = pdMS_TO_TICKS(notificationIntervalMs - elapsed) + 1;
+                if (remaining < wait) wait = remaining;
+            }
+        }
+        portEXIT_CRITICAL(&notify_mux);
+
+        if (due) {
+            StaticJsonDocument<128> params;
+            params["uri"] = entry.resource.uri.c_str();
+            notify("notifications/resources/updated", params.as<JsonVariantConst>());
+        }
+    }
+    return wait;
+}
+
 void BLEMCPServer::RegisterTool(const Tool& tool) {
-    tools[tool.name] = tool;
+    ToolEntry entry;
+    entry.hash = mcpHashString(tool.name.c_str());
+    entry.name = tool.name;
+    entry.description = tool.description;
+    entry.handler = tool.handler;
+    entry.cacheTtlMs = tool.cacheTtlMs;
+    // Flattened once and kept on the tool too, so Tool::toString() reuses it.
+    bool ok = !tool.inputSchema.flat().empty();
+    if (ok) entry.inputSchema = tool.inputSchema.flat();
+    if (ok && tool.outputSchema.type.length() > 0) {
+        ok = !tool.outputSchema.flat().empty();
+        if (ok) entry.outputSchema = tool.outputSchema.flat();
+    }
+    if (!ok) {
+        Serial.printf("Tool rejected, schema too deep or too large: %s\n", tool.name.c_str());
+        return;
+    }
+    entry.validator.compile(entry.inputSchema);
+    updateTools([&](ToolTable& table) {
+        insertTool(table, std::move(entry));
+        return true;
+    });
     Serial.printf("Tool registered: %s\n", tool.name.c_str());
 }
 
-MCPRequest BLEMCPServer::parseRequest(const std::string& json) {
-    DynamicJsonDocument doc(8192);
-    DeserializationError error = deserializeJson(doc, json);
+void BLEMCPServer::RegisterTool(const ToolDefinition& definition) {
+    RegisterTools(&definition, 1);
+}
+
+void BLEMCPServer::RegisterTools(const ToolDefinition* definitions, size_t count) {
+    // The schema text stays in flash; only the validator is built on the heap.
+    std::vector<ToolEntry> entries;
+    entries.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        const ToolDefinition& definition = definitions[i];
+        ToolEntry entry;
+        entry.hash = mcpHashString(definition.name);
+        entry.definition = &definition;
+        FlatSchema schema;
+        if (!parseSchemaText(definition.inputSchema, schema)) {
+            Serial.printf("Tool rejected, invalid input schema: %s\n", definition.name);
+            continue;
+        }
+        FlatSchema outputSchema;
+        if (definition.outputSchema && !parseSchemaText(definition.outputSchema, outputSchema)) {
+            Serial.printf("Tool rejected, invalid output schema: %s\n", definition.name);
+            continue;
+        }
+        entry.validator.compile(schema);
+        entries.push_back(std::move(entry));
+    }
+    if (entries.empty()) return;
+    updateTools([&](ToolTable& table) {
+        table.reserve(table.size() + entries.size());
+        for (ToolEntry& entry : entries) {
+            insertTool(table, std::move(entry));
+        }
+        return true;
+    });
+    for (const ToolEntry& entry : entries) {
+        Serial.printf("Tool registered: %s\n", entry.definition->name);
+    }
+}
 
-    MCPRequest request;
+bool BLEMCPServer::UnregisterTool(const String& name) {
+    uint32_t hash = mcpHashString(name.c_str());
+    bool removed = updateTools([&](ToolTable& table) {
+        for (auto it = table.begin(); it != table.end(); ++it) {
+            if (it->hash == hash && strcmp(it->toolName(), name.c_str()) == 0) {
+                table.erase(it);
+                return true;
+            }
+        }
+        return false;
+    });
+    if (removed) {
+        Serial.printf("Tool unregistered: %s\n", name.c_str());
+    }
+    return removed;
+}
 
-    if (error) {
-        request.method = "";
-        return request;
+// Writers pay for the copy so that readers never wait: a request keeps the
+// table it started with even if tools change while it runs.
+template <typename Edit>
+bool BLEMCPServer::updateTools(Edit edit) {
+    xSemaphoreTake(tools_lock, portMAX_DELAY);
+    const ToolTable* current = toolTable.load();
+    ToolTable* next = current ? new ToolTable(*current) : new ToolTable();
+    if (!edit(*next)) {
+        delete next;
+        xSemaphoreGive(tools_lock);
+        return false;
+    }
+    // Fresh epochs for new and replaced tools, so no cached result of an
+    // earlier version with the same name is served.
+    for (ToolEntry& entry : *next) {
+        if (entry.cacheEpoch.value.load(std::memory_order_relaxed) == 0) {
+            entry.cacheEpoch.value.store(++cacheEpochs, std::memory_order_relaxed);
+        }
+    }
+    ToolTable* old = toolTable.exchange(next);
+    if (old) {
+        retiredTools.push_back(old);
+        toolsRetired.store(true);
+    }
+    reclaimTools();
+    xSemaphoreGive(tools_lock);
+
+    // Coalesced into one notification, sent by the server task.
+    bool queued = false;
+    if (McpBle::getInstance().isConnected()) {
+        portENTER_CRITICAL(&notify_mux);
+        queued = !toolsChanged;
+        toolsChanged = true;
+        portEXIT_CRITICAL(&notify_mux);
     }
+    if (queued) {
+        wake();
+    }
+    return true;
+}
 
-    request.method = doc["method"].as<std::string>();
-    request.idDoc.set(doc["id"]);
-    request.paramsDoc.set(doc["params"]);
-    return request;
+// Called with tools_lock held. A snapshot taken after a table was retired
+// sees its replacement, so once the reader count has been zero every
+// retired table is unreachable.
+void BLEMCPServer::reclaimTools() {
+    if (toolReaders.load() != 0) return;
+    for (ToolTable* table : retiredTools) {
+        delete table;
+    }
+    retiredTools.clear();
+    toolsRetired.store(false);
 }
 
-std::string BLEMCPServer::serializeResponse(const MCPResponse& response) {
-    DynamicJsonDocument doc(8192);
-    JsonVariantConst idVariant = response.id();
-    if (idVariant.is<const char*>() || idVariant.is<String>()) {
-        doc["id"] = idVariant.as<String>();
-    } else if (idVariant.is<int>() || idVariant.is<long>() || idVariant.is<unsigned int>() || idVariant.is<unsigned long>()) {
-        doc["id"] = idVariant.as<long>();
-    } else if (idVariant.isNull()) {
-        doc["id"] = nullptr;
-    } else {
-        doc["id"] = idVariant;
+BLEMCPServer::ToolSnapshot::ToolSnapshot(const BLEMCPServer& server) : server(server) {
+    // Counted before loading, so reclaimTools() cannot free what is loaded.
+    server.toolReaders.fetch_add(1);
+    table = server.toolTable.load();
+}
+
+BLEMCPServer::ToolSnapshot::~ToolSnapshot() {
+    server.toolReaders.fetch_sub(1);
+}
+
+void BLEMCPServer::insertTool(ToolTable& table, ToolEntry&& entry) {
+    entry.cacheEpoch.value.store(0, std::memory_order_relaxed);  // assigned by updateTools()
+    auto it = std::lower_bound(table.begin(), table.end(), entry.hash,
+                               [](const ToolEntry& e, uint32_t hash) { return e.hash < hash; });
+    for (auto same = it; same != table.end() && same->hash == entry.hash; ++same) {
+        if (strcmp(same->toolName(), entry.toolName()) == 0) {
+            *same = std::move(entry);
+            return;
+        }
     }
-    doc["jsonrpc"] = "2.0";
+    table.insert(it, std::move(entry));
+}
+
+const BLEMCPServer::ToolEntry* BLEMCPServer::findTool(const ToolTable* table, const char* name) {
+    if (!table) return nullptr;
+    uint32_t hash = mcpHashString(name);
+    auto it = std::lower_bound(table->begin(), table->end(), hash,
+                               [](const ToolEntry& e, uint32_t h) { return e.hash < h; });
+    for (; it != table->end() && it->hash == hash; ++it) {
+        if (strcmp(it->toolName(), name) == 0) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+// The resource and method tables are read without a lock by the server
+// task, so unlike tools they are fixed once begin() has run.
+void BLEMCPServer::RegisterResource(const Resource& resource) {
+    if (rx_ready) {
+        Serial.printf("Resource rejected, register before begin(): %s\n", resource.uri.c_str());
+        return;
+    }
+    if (!resource.provider) {
+        Serial.printf("Resource rejected, no provider: %s\n", resource.uri.c_str());
+        return;
+    }
+    uint32_t hash = mcpHashString(resource.uri.c_str());
+    auto it = std::lower_bound(resources.begin(), resources.end(), hash,
+                               [](const ResourceEntry& e, uint32_t h) { return e.hash < h; });
+    for (auto same = it; same != resources.end() && same->hash == hash; ++same) {
+        if (same->resource.uri == resource.uri) {
+            same->resource = resource;
+            return;
+        }
+    }
+    ResourceEntry entry;
+    entry.hash = hash;
+    entry.resource = resource;
+    resources.insert(it, std::move(entry));
+    Serial.printf("Resource registered: %s\n", resource.uri.c_str());
+}
+
+BLEMCPServer::ResourceEntry* BLEMCPServer::findResource(const char* uri) {
+    uint32_t hash = mcpHashString(uri);
+    auto it = std::lower_bound(resources.begin(), resources.end(), hash,
+                               [](const ResourceEntry& e, uint32_t h) { return e.hash < h; });
+    for (; it != resources.end() && it->hash == hash; ++it) {
+        if (strcmp(it->resource.uri.c_str(), uri) == 0) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+void BLEMCPServer::RegisterMethod(const String& method, MethodHandler handler) {
+    if (rx_ready) {
+        Serial.printf("Method rejected, register before begin(): %s\n", method.c_str());
+        return;
+    }
+    uint32_t hash = mcpHashString(method.c_str());
+    if (isBuiltinMethod(method.c_str(), hash)) {
+        Serial.printf("Method is built in: %s\n", method.c_str());
+        return;
+    }
+    auto it = std::lower_bound(methods.begin(), methods.end(), hash,
+                               [](const MethodEntry& e, uint32_t h) { return e.hash < h; });
+    for (auto same = it; same != methods.end() && same->hash == hash; ++same) {
+        if (same->name == method) {
+            same->handler = handler;
+            return;
+        }
+    }
+    methods.insert(it, MethodEntry{hash, method, handler});
+}
+
+const BLEMCPServer::MethodEntry* BLEMCPServer::findMethod(const char* name, uint32_t hash) const {
+    auto it = std::lower_bound(methods.begin(), methods.end(), hash,
+                               [](const MethodEntry& e, uint32_t h) { return e.hash < h; });
+    for (; it != methods.end() && it->hash == hash; ++it) {
+        if (strcmp(it->name.c_str(), name) == 0) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+// The document starts from an estimate based on the message length and is
+// grown on NoMemory while the budget allows. It is reused, so a warmed-up
+// request is parsed without allocating; see trimBuffers().
+DeserializationError BLEMCPServer::parseRequest(const char* json, MCPRequest& request) {
+    size_t length = strlen(json);
+    size_t limit = remainingBudget();
+    size_t capacity = length * 2 + 64;
+    if (capacity < requestCapacity) capacity = requestCapacity;
+    DeserializationError error;
+    for (;;) {
+        if (capacity > limit) capacity = limit;
+        if (request.doc.capacity() < capacity) {
+            request.doc = DynamicJsonDocument(capacity);
+        }
+        error = deserializeJson(request.doc, json, length);
+        if (error != DeserializationError::NoMemory || request.doc.capacity() >= limit) break;
+        capacity = request.doc.capacity() * 2;
+    }
+    if (error) {
+        request.doc.clear();
+        request.method.clear();
+        return error;
+    }
+    chargeRequest(request.doc.memoryUsage());
+
+    const char* method = request.doc["method"];
+    request.method.assign(method ? method : "");
+    return error;
+}
 
+// Written field by field into `out`; the response documents are not copied
+// into another one.
+void BLEMCPServer::serializeResponse(const MCPResponse& response, std::string& out) {
+    JsonVariantConst id = response.id();
+    size_t length = 32 + measureJson(id);
+    if (response.hasResult()) length += 10 + measureJson(response.result());
+    if (response.hasError()) length += 9 + measureJson(response.error());
+
+    out.clear();
+    out.reserve(length);
+    out += "{\"id\":";
+    serializeJson(id, out);
+    out += ",\"jsonrpc\":\"2.0\"";
     if (response.hasResult()) {
-        doc["result"] = response.result();
+        out += ",\"result\":";
+        serializeJson(response.result(), out);
     }
     if (response.hasError()) {
-        doc["error"] = response.error();
+        out += ",\"error\":";
+        serializeJson(response.error(), out);
     }
-
-    std::string jsonResponse;
-    serializeJson(doc, jsonResponse);
-    return jsonResponse;
+    out += "}";
 }
 
-void BLEMCPServer::sendResponse(const std::string& jsonResponse, int httpStatusCode) {
+// Sent as a stream, which mcp_transport_send_message() also uses but caps
+// at the 8 KB single-message limit: a response is already bounded by the
+// memory budget, and a long tools/list can exceed 8 KB.
+void BLEMCPServer::sendResponse(const char* jsonResponse, int httpStatusCode) {
     (void)httpStatusCode; // Not used in BLE
-    mcp_transport_send_message(jsonResponse.c_str());
+    size_t length = strlen(jsonResponse);
+    if (mcp_transport_stream_begin(length)) {
+        mcp_transport_stream_write((const uint8_t*)jsonResponse, length);
+        mcp_transport_stream_end();
+    }
+}
+
+bool BLEMCPServer::respond(const MCPRequest& request, MCPResponse response) {
+    trace(TraceStage::HANDLED, 0);
+    // Built-in responses are sized within the budget up front (fillSized);
+    // only a custom method's response can exceed it, after its handler ran.
+    bool withinBudget = chargeRequest(response.capacity());
+    if (!withinBudget) {
+        response = createJSONRPCError(static_cast<int>(ErrorCode::SERVER_ERROR), request.id(),
+                                      "Response exceeds memory budget; the request was handled");
+    }
+    // Only results are replayed: an error (bad arguments, no budget, a busy
+    // stream) is answered afresh when the request is resent.
+    if (!response.error().isNull()) {
+        txReplayable = false;
+    }
+    serializeResponse(response, txBuffer);
+    trace(TraceStage::SERIALIZED, txBuffer.size());
+    chargeRequest(txBuffer.size());
+    sendResponse(txBuffer.c_str(), response.httpStatusCode);
+    return withinBudget;
+}
+
+void BLEMCPServer::processMessage(RxMessage* message) {
+    traceRequest = message->seq;
+    trace(TraceStage::DEQUEUED, 0);
+    {
+        // Tool entries and their schema strings are used until the response
+        // is sent, so the request sees one table throughout.
+        ToolSnapshot tools(*this);
+        requestTools = &tools;
+        dispatchMessage(message->text, rxRequest);
+        recordLatency(rxRequest, micros() - message->rxDoneUs);
+        requestTools = nullptr;
+    }
+    trimBuffers();
+    // Quiescent point: no snapshot is held on this task.
+    if (toolsRetired.load() && xSemaphoreTake(tools_lock, 0) == pdTRUE) {
+        reclaimTools();
+        xSemaphoreGive(tools_lock);
+    }
+    traceRequest = 0;
+}
+
+void BLEMCPServer::trimBuffers() {
+    if (rxRequest.doc.capacity() > kRetainedBufferBytes) {
+        rxRequest.doc = DynamicJsonDocument(requestCapacity);
+    }
+    if (toolResultDoc.capacity() > kRetainedBufferBytes && toolResultDoc.capacity() > toolResultCapacity) {
+        toolResultDoc = DynamicJsonDocument(toolResultCapacity);
+    }
+    if (toolText.capacity() > kRetainedBufferBytes) {
+        std::string().swap(toolText);
+    }
+    if (txBuffer.capacity() > kRetainedBufferBytes) {
+        std::string().swap(txBuffer);
+    }
+}
+
+void BLEMCPServer::dispatchMessage(const char* message, MCPRequest& request) {
+    requestBytes = 0;
+    txBuffer.clear();
+    txReplayable = true;
+    if (prescreen(message, request)) {
+        recordRequest(false);
+        return;
+    }
+    DeserializationError parsed = parseRequest(message, request);
+    trace(TraceStage::PARSED, strlen(message));
+    if (parsed == DeserializationError::NoMemory) {
+        MCPResponse error = createJSONRPCError(static_cast<int>(ErrorCode::SERVER_ERROR), JsonVariantConst(),
+                                               "Request exceeds memory budget");
+        serializeResponse(error, txBuffer);
+        sendResponse(txBuffer.c_str(), error.httpStatusCode);
+        recordRequest(true);
+        return;
+    }
+
+    // Only custom methods reach here as notifications (see prescreen());
+    // their handler runs and whatever it returns is dropped.
+    if (!request.method.empty() && !request.doc.containsKey("id")) {
+        handle(request);
+        trace(TraceStage::HANDLED, 0);
+        recordRequest(false);
+        return;
+    }
+
+    // A request resent after a dropped link is answered from the replay
+    // table instead of running again. Requests are processed one at a time,
+    // so a resend of a request still running is queued behind it and finds
+    // its response here once it completes.
+    char replayId[64];
+    size_t replayIdLength = 0;
+    uint32_t requestHash = 0;
+    if (isReplayable(request)) {
+        replayIdLength = serializeJson(request.id(), replayId, sizeof(replayId));
+        if (replayIdLength >= sizeof(replayId) - 1) {
+            replayIdLength = 0;  // too long to store; possibly truncated
+        }
+    }
+    if (replayIdLength > 0) {
+        requestHash = mcpHashString(message);
+        const ReplayEntry* done = findReplay(replayId, replayIdLength, requestHash);
+        if (done) {
+            ESP_LOGI(TAG, "Replaying response to id %s", replayId);
+            sendResponse(replayArena.get() + done->offset + done->idLength, 200);
+            recordRequest(false);
+            return;
+        }
+    }
+
+    // tools/call writes its response straight into txBuffer; see callTool().
+    bool withinBudget = true;
+    if (request.method == "tools/call") {
+        withinBudget = handleFunctionCalls(request);
+    } else {
+        MCPResponse response = handle(request);
+        if (response.sent) {
+            trace(TraceStage::HANDLED, 0);
+        } else {
+            withinBudget = respond(request, std::move(response));
+        }
+    }
+    // Streamed responses never reach txBuffer and are not replayed.
+    if (replayIdLength > 0 && txReplayable && !txBuffer.empty()) {
+        storeReplay(replayId, replayIdLength, requestHash, txBuffer);
+    }
+    recordRequest(!withinBudget);
+}
+
+// JSON-RPC notifications (no "id") never get a reply, not even an error.
+// Built-in notifications are handled here; built-in requests sent without
+// an id are dropped, since nobody would read the answer. Requests for
+// methods that do not exist are answered from the scanned id, but only
+// once the message is known to be valid JSON; otherwise the full parse
+// answers PARSE_ERROR with a null id. Names with escapes are left to the
+// full parse.
+bool BLEMCPServer::prescreen(const char* message, MCPRequest& request) {
+    const char* id = nullptr;
+    size_t idLen = 0;
+    const char* value;
+    size_t len;
+    bool hasId = findMember(message, "id", id, idLen);
+    if (!findMember(message, "method", value, len)) {
+        return false;  // responses and malformed JSON: the parse reports them
+    }
+    char name[64];
+    if (*value != '"') {
+        if (hasId) {
+            if (parseRequest(message, request)) {
+                return false;  // malformed: the full parse reports it
+            }
+            sendScannedError(id, idLen, static_cast<int>(ErrorCode::INVALID_REQUEST),
+                             "Invalid request: method must be a string", "");
+        }
+        request.doc.clear();
+        request.method.clear();
+        return true;
+    }
+    len -= 2;
+    if (len >= sizeof(name) || memchr(value + 1, '\\', len)) {
+        return false;
+    }
+    memcpy(name, value + 1, len);
+    name[len] = '\0';
+
+    uint32_t hash = mcpHashString(name);
+    bool builtin = isBuiltinMethod(name, hash);
+    if (!builtin && findMethod(name, hash)) {
+        return false;
+    }
+    if (builtin && hasId) {
+        return false;
+    }
+    if (hasId && parseRequest(message, request)) {
+        return false;  // malformed: the full parse reports it
+    }
+    trace(TraceStage::PARSED, 0);
+    request.doc.clear();
+    request.method.assign(name, len);  // for the latency histogram
+    if (!hasId) {
+        if (builtin && hash == mcpHash("notifications/initialized")) {
+            ESP_LOGI(TAG, "Client initialized");
+        } else {
+            ESP_LOGD(TAG, "Ignoring notification %s", name);
+        }
+        trace(TraceStage::HANDLED, 0);
+        return true;
+    }
+    sendScannedError(id, idLen, static_cast<int>(ErrorCode::METHOD_NOT_FOUND), "Method not found: ", name);
+    return true;
 }
 
-void BLEMCPServer::processMessage(const char* message) {
-    MCPRequest request = parseRequest(message);
-    MCPResponse response = handle(request);
-    std::string jsonResponse = serializeResponse(response);
-    sendResponse(jsonResponse, response.httpStatusCode);
+void BLEMCPServer::sendScannedError(const char* id, size_t idLength, int code, const char* message,
+                                    const char* detail) {
+    trace(TraceStage::HANDLED, 0);
+    txBuffer = "{\"id\":";
+    txBuffer.append(id, idLength);
+    txBuffer += ",\"jsonrpc\":\"2.0\",\"error\":{\"code\":";
+    char number[12];
+    snprintf(number, sizeof(number), "%d", code);
+    txBuffer += number;
+    txBuffer += ",\"message\":\"";
+    appendEscaped(txBuffer, message);
+    appendEscaped(txBuffer, detail);
+    txBuffer += "\"}}";
+    trace(TraceStage::SERIALIZED, txBuffer.size());
+    chargeRequest(txBuffer.size());
+    sendResponse(txBuffer.c_str(), 200);
+}
+
+// Only methods with effects are worth replaying: tools/call and custom
+// methods. Built-in queries are cheap to answer again.
+bool BLEMCPServer::isReplayable(const MCPRequest& request) const {
+    if (replayLimit == 0 || request.id().isNull() || request.method.empty()) {
+        return false;
+    }
+    const char* method = request.method.c_str();
+    uint32_t hash = mcpHashString(method);
+    return hash == mcpHash("tools/call") ? strcmp(method, "tools/call") == 0 : !isBuiltinMethod(method, hash);
+}
+
+const BLEMCPServer::ReplayEntry* BLEMCPServer::findReplay(const char* id, size_t idLength,
+                                                          uint32_t requestHash) const {
+    for (const ReplayEntry& entry : replay) {
+        // Same id with a different request is a reused id, not a resend.
+        if (entry.requestHash == requestHash && entry.idLength == idLength &&
+            memcmp(replayArena.get() + entry.offset, id, idLength) == 0) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool BLEMCPServer::replayOverlaps(size_t offset, size_t length) const {
+    for (const ReplayEntry& entry : replay) {
+        if (entry.offset < offset + length && offset < entry.offset + entry.idLength + entry.responseLength + 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Entries are written one after another and wrap to the start of the arena
+// when the next one does not fit; the oldest are evicted until the space is
+// free. The arena and the entry table are allocated once.
+void BLEMCPServer::storeReplay(const char* id, size_t idLength, uint32_t requestHash, const std::string& response) {
+    size_t length = idLength + response.size() + 1;
+    if (replayLimit == 0 || length > replayBytesLimit) {
+        return;
+    }
+    if (!replayArena) {
+        replayArena.reset(new char[replayBytesLimit]);
+        replay.reserve(replayLimit);
+    }
+    for (auto it = replay.begin(); it != replay.end(); ++it) {
+        if (it->idLength == idLength && memcmp(replayArena.get() + it->offset, id, idLength) == 0) {
+            replay.erase(it);
+            break;
+        }
+    }
+    size_t offset = replayHead + length <= replayBytesLimit ? replayHead : 0;
+    while (!replay.empty() && (replay.size() >= replayLimit || replayOverlaps(offset, length))) {
+        replay.erase(replay.begin());
+    }
+    char* out = replayArena.get() + offset;
+    memcpy(out, id, idLength);
+    memcpy(out + idLength, response.c_str(), response.size() + 1);
+
+    ReplayEntry entry;
+    entry.requestHash = requestHash;
+    entry.offset = offset;
+    entry.idLength = idLength;
+    entry.responseLength = response.size();
+    replay.push_back(entry);
+    replayHead = offset + length;
+}
+
+void BLEMCPServer::setReplayLimits(size_t entries, size_t bytes) {
+    replayLimit = entries;
+    replayBytesLimit = bytes;
+    replay.clear();
+    replay.shrink_to_fit();
+    replayArena.reset();
+    replayHead = 0;
+}
+
+bool BLEMCPServer::isBuiltinMethod(const char* name, uint32_t hash) {
+    switch (hash) {
+        case mcpHash("initialize"):
+            return strcmp(name, "initialize") == 0;
+        case mcpHash("notifications/initialized"):
+            return strcmp(name, "notifications/initialized") == 0;
+        case mcpHash("ping"):
+            return strcmp(name, "ping") == 0;
+        case mcpHash("diagnostics"):
+            return strcmp(name, "diagnostics") == 0;
+        case mcpHash("tools/list"):
+            return strcmp(name, "tools/list") == 0;
+        case mcpHash("tools/call"):
+            return strcmp(name, "tools/call") == 0;
+        case mcpHash("resources/list"):
+            return strcmp(name, "resources/list") == 0;
+        case mcpHash("resources/read"):
+            return strcmp(name, "resources/read") == 0;
+        case mcpHash("resources/subscribe"):
+            return strcmp(name, "resources/subscribe") == 0;
+        case mcpHash("resources/unsubscribe"):
+            return strcmp(name, "resources/unsubscribe") == 0;
+        default:
+            return false;
+    }
 }
 
 MCPResponse BLEMCPServer::handle(MCPRequest& request) {
@@ -288,21 +1724,46 @@ MCPResponse BLEMCPServer::handle(MCPRequest& request) {
         return createJSONRPCError(static_cast<int>(ErrorCode::PARSE_ERROR), request.id(), "Parse error: Invalid JSON");
     }
 
-    if (request.method == "initialize") {
-        return handleInitialize(request);
-    } else if (request.method == "tools/list") {
-        return handleToolsList(request);
-    } else if (request.method == "notifications/initialized") {
-        return handleInitialized(request);
-    } else if (request.method == "tools/call") {
-        return handleFunctionCalls(request);
-    } else {
-        return createJSONRPCError(static_cast<int>(ErrorCode::METHOD_NOT_FOUND), request.id(), "Method not found: " + request.method);
+    const char* method = request.method.c_str();
+    uint32_t hash = mcpHashString(method);
+    if (isBuiltinMethod(method, hash)) {
+        switch (hash) {
+            case mcpHash("initialize"):
+                return handleInitialize(request);
+            case mcpHash("notifications/initialized"):
+                return handleInitialized(request);
+            case mcpHash("ping"):
+                return handlePing(request);
+            case mcpHash("diagnostics"):
+                return handleDiagnostics(request);
+            case mcpHash("tools/list"):
+                return handleToolsList(request);
+            // tools/call is answered in place by dispatchMessage().
+            case mcpHash("resources/list"):
+                return handleResourcesList(request);
+            case mcpHash("resources/read"):
+                return handleResourcesRead(request);
+            case mcpHash("resources/subscribe"):
+                return handleResourcesSubscribe(request, true);
+            case mcpHash("resources/unsubscribe"):
+                return handleResourcesSubscribe(request, false);
+        }
+    }
+
+    const MethodEntry* custom = findMethod(method, hash);
+    if (custom && custom->handler) {
+        return custom->handler(request);
     }
+    return createJSONRPCError(static_cast<int>(ErrorCode::METHOD_NOT_FOUND), request.id(), "Method not found: " + request.method);
 }
 
+// The replay table is kept: clients initialize again on every reconnect,
+// and that is when a request cut off by the link drop is resent. A reused
+// id does not match, since entries are keyed by the whole message too.
 MCPResponse BLEMCPServer::handleInitialize(MCPRequest& request) {
-    MCPResponse response(request.id());
+    // Strings are linked, not copied, so only the nodes need room.
+    MCPResponse response(request.id(), JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(1) +
+                                           JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(2));
     JsonObject result = response.resultDoc.to<JsonObject>();
 
     result["protocolVersion"] = PROTOCOL_VERSION;
@@ -311,92 +1772,708 @@ MCPResponse BLEMCPServer::handleInitialize(MCPRequest& request) {
     JsonObject experimental = capabilities["experimental"].to<JsonObject>();
 
     JsonObject tools = capabilities["tools"].to<JsonObject>();
-    tools["listChanged"] = false;
+    tools["listChanged"] = true;
+
+    if (!resources.empty()) {
+        JsonObject resourcesCap = capabilities["resources"].to<JsonObject>();
+        resourcesCap["subscribe"] = true;
+        resourcesCap["listChanged"] = false;
+    }
 
     JsonObject serverInfo = result["serverInfo"].to<JsonObject>();
-    serverInfo["name"] = serverName;
-    serverInfo["version"] = serverVersion;
+    serverInfo["name"] = serverName.c_str();
+    serverInfo["version"] = serverVersion.c_str();
 
     if (serverInstructions.length() > 0) {
-        result["instructions"] = serverInstructions;
+        result["instructions"] = serverInstructions.c_str();
     }
     return response;
 }
 
 MCPResponse BLEMCPServer::handleInitialized(MCPRequest& request) {
     ESP_LOGI(TAG, "Client initialized");
-    MCPResponse response(request.id());
+    MCPResponse response(request.id(), 0);
     response.resultDoc.to<JsonObject>();
     response.httpStatusCode = 202;
     return response;
 }
 
-MCPResponse BLEMCPServer::handleToolsList(MCPRequest& request) {
-    MCPResponse response(request.id());
-    JsonObject result = response.resultDoc.to<JsonObject>();
-    JsonArray toolsArray = result["tools"].to<JsonArray>();
-    
-    for (const auto& kv : tools) {
-        const String& key = kv.first;
-        const Tool& value = kv.second;
-        JsonObject tool = toolsArray.createNestedObject();
-        tool["name"] = key;
-        tool["description"] = value.description;
+// Answered without touching tools, so clients can measure round-trip time
+// apart from tool cost.
+MCPResponse BLEMCPServer::handlePing(MCPRequest& request) {
+    MCPResponse response(request.id(), 0);
+    response.resultDoc.to<JsonObject>();
+    return response;
+}
+
+// Latency histograms per method and per tool, and the stage trace ring
+// (oldest record first) as base64 of packed little-endian TraceRecords.
+MCPResponse BLEMCPServer::handleDiagnostics(MCPRequest& request) {
+    static_assert(sizeof(TraceRecord) == 12, "TraceRecord is dumped as 12 bytes");
+    static TraceRecord ring[MCP_TRACE_DEPTH];  // server task only
+    portENTER_CRITICAL(&stats_mux);
+    uint32_t next = traceNext;
+    memcpy(ring, traceRing, sizeof(ring));
+    portEXIT_CRITICAL(&stats_mux);
+
+    // Two runs, each a whole number of 12-byte records, so neither needs
+    // base64 padding and they concatenate.
+    size_t count = next < MCP_TRACE_DEPTH ? next : MCP_TRACE_DEPTH;
+    size_t start = next < MCP_TRACE_DEPTH ? 0 : next % MCP_TRACE_DEPTH;
+    std::string data(count * sizeof(TraceRecord) / 3 * 4, '\0');
+    size_t first = count < MCP_TRACE_DEPTH - start ? count : MCP_TRACE_DEPTH - start;
+    size_t written = base64Encode((const uint8_t*)&ring[start], first * sizeof(TraceRecord), &data[0]);
+    base64Encode((const uint8_t*)&ring[0], (count - first) * sizeof(TraceRecord), &data[written]);
+
+    MCPResponse response(request.id(), 0);
+    bool fits = fillSized(response.resultDoc, diagnosticsCapacity, remainingBudget(), [&](DynamicJsonDocument& doc) {
+        JsonObject result = doc.to<JsonObject>();
+        result["cyclesPerUs"] = ESP.getCpuFreqMHz();
+        result["bucketUs"] = 128;
+
+        JsonArray entries = result["latency"].to<JsonArray>();
+        for (const LatencyStats& stats : latency) {
+            JsonObject entry = entries.createNestedObject();
+            if (stats.tool) {
+                entry["method"] = "tools/call";
+                entry["tool"] = stats.name.c_str();
+            } else {
+                entry["method"] = stats.name.c_str();
+            }
+            entry["count"] = stats.count;
+            entry["avgUs"] = stats.count ? (uint32_t)(stats.totalUs / stats.count) : 0;
+            entry["maxUs"] = stats.maxUs;
+            JsonArray histogram = entry["histogram"].to<JsonArray>();
+            for (uint16_t bucket : stats.buckets) {
+                histogram.add(bucket);
+            }
+        }
+
+        JsonArray tasks = result["tasks"].to<JsonArray>();
+        const TaskStage stages[] = {TaskStage::DISPATCH, TaskStage::TOOL};
+        for (TaskStage stage : stages) {
+            TaskStats stats = getTaskStats(stage);
+            if (!stats.running) continue;
+            JsonObject task = tasks.createNestedObject();
+            task["name"] = stage == TaskStage::TOOL ? "tool" : "dispatch";
+            task["priority"] = stats.priority;
+            if (stats.core != tskNO_AFFINITY) task["core"] = stats.core;
+            task["stackBytes"] = stats.stackBytes;
+            task["stackFreeMin"] = stats.stackFreeMin;
+        }
 
-        JsonObject inputSchemaObj = tool["inputSchema"].to<JsonObject>();
-        value.inputSchema.toJson(inputSchemaObj);
+        JsonObject traceObj = result["trace"].to<JsonObject>();
+        traceObj["recordSize"] = sizeof(TraceRecord);
+        traceObj["records"] = count;
+        traceObj["data"] = data;  // copied: data is gone before serialization
+    });
+    if (!fits) {
+        return createJSONRPCError(static_cast<int>(ErrorCode::SERVER_ERROR), request.id(),
+                                  "Diagnostics exceed memory budget");
+    }
+    return response;
+}
 
-        if (value.outputSchema.type.length() > 0) {
-            JsonObject outputSchemaObj = tool["outputSchema"].to<JsonObject>();
-            value.outputSchema.toJson(outputSchemaObj);
+MCPResponse BLEMCPServer::handleToolsList(MCPRequest& request) {
+    MCPResponse response(request.id(), 0);
+    bool fits = fillSized(response.resultDoc, toolsListCapacity, remainingBudget(), [this](DynamicJsonDocument& doc) {
+        JsonObject result = doc.to<JsonObject>();
+        JsonArray toolsArray = result["tools"].to<JsonArray>();
+
+        for (const ToolEntry& entry : *requestTools) {
+            JsonObject tool = toolsArray.createNestedObject();
+            if (entry.definition) {
+                // Linked by pointer; the schema text is emitted straight from
+                // flash when serializing.
+                const ToolDefinition* definition = entry.definition;
+                tool["name"] = definition->name;
+                tool["description"] = definition->description;
+                tool["inputSchema"] = serialized(definition->inputSchema);
+                if (definition->outputSchema) {
+                    tool["outputSchema"] = serialized(definition->outputSchema);
+                }
+                continue;
+            }
+
+            tool["name"] = entry.name;
+            tool["description"] = entry.description;
+
+            JsonObject inputSchemaObj = tool["inputSchema"].to<JsonObject>();
+            entry.inputSchema.toJson(inputSchemaObj);
+
+            if (!entry.outputSchema.empty()) {
+                JsonObject outputSchemaObj = tool["outputSchema"].to<JsonObject>();
+                entry.outputSchema.toJson(outputSchemaObj);
+            }
         }
+    });
+    if (!fits) {
+        return createJSONRPCError(static_cast<int>(ErrorCode::SERVER_ERROR), request.id(), "Tool list exceeds memory budget");
     }
     return response;
 }
 
-MCPResponse BLEMCPServer::handleFunctionCalls(MCPRequest& request) {
-    MCPResponse mcpResponse(request.id());
+bool BLEMCPServer::handleFunctionCalls(MCPRequest& request) {
     JsonVariantConst params = request.params();
 
-    if (!params["name"].is<std::string>()) {
-        return createJSONRPCError(static_cast<int>(ErrorCode::INVALID_PARAMS), request.id(), "Missing or invalid 'name' parameter");
+    if (!params["name"].is<const char*>()) {
+        return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::INVALID_PARAMS), request.id(),
+                                                   "Missing or invalid 'name' parameter"));
     }
 
-    std::string functionName = params["name"];
+    const char* functionName = params["name"];
     JsonVariantConst arguments = params["arguments"];
 
-    JsonObject result = mcpResponse.resultDoc.to<JsonObject>();
-    JsonArray content = result["content"].to<JsonArray>();
+    const ToolEntry* tool = requestTools->find(functionName);
+    if (!tool) {
+        return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::METHOD_NOT_FOUND), request.id(),
+                                                   std::string("Method not supported: ") + functionName));
+    }
+    if (!tool->toolHandler()) {
+        return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::INTERNAL_ERROR), request.id(),
+                                                   std::string("Tool handler not initialized: ") + functionName));
+    }
+    return callTool(request, *tool, arguments);
+}
+
+MCPResponse BLEMCPServer::handleResourcesList(MCPRequest& request) {
+    MCPResponse response(request.id(), 0);
+    bool fits =
+        fillSized(response.resultDoc, resourcesListCapacity, remainingBudget(), [this](DynamicJsonDocument& doc) {
+            JsonObject result = doc.to<JsonObject>();
+            JsonArray resourcesArray = result["resources"].to<JsonArray>();
+
+            for (const ResourceEntry& entry : resources) {
+                const Resource& resource = entry.resource;
+                JsonObject item = resourcesArray.createNestedObject();
+                item["uri"] = resource.uri;
+                item["name"] = resource.name.length() > 0 ? resource.name : resource.uri;
+                if (resource.description.length() > 0) {
+                    item["description"] = resource.description;
+                }
+                if (resource.mimeType.length() > 0) {
+                    item["mimeType"] = resource.mimeType;
+                }
+                item["size"] = resource.provider->size();
+            }
+        });
+    if (!fits) {
+        return createJSONRPCError(static_cast<int>(ErrorCode::SERVER_ERROR), request.id(),
+                                  "Resource list exceeds memory budget");
+    }
+    return response;
+}
+
+// params: uri, optional byte range offset/length. The response is streamed
+// straight from the provider to the transport and carries the range served
+// in result._meta so clients can page through resources of any size.
+MCPResponse BLEMCPServer::handleResourcesRead(MCPRequest& request) {
+    JsonVariantConst params = request.params();
+
+    if (!params["uri"].is<const char*>()) {
+        return createJSONRPCError(static_cast<int>(ErrorCode::INVALID_PARAMS), request.id(), "Missing or invalid 'uri' parameter");
+    }
+    const char* uri = params["uri"];
+    ResourceEntry* entry = findResource(uri);
+    if (!entry) {
+        return createJSONRPCError(static_cast<int>(ErrorCode::RESOURCE_NOT_FOUND), request.id(),
+                                  std::string("Resource not found: ") + uri);
+    }
+
+    size_t total = entry->resource.provider->size();
+    size_t offset = params["offset"].as<unsigned long>();
+    if (offset > total) {
+        return createJSONRPCError(static_cast<int>(ErrorCode::INVALID_PARAMS), request.id(), "Offset beyond end of resource");
+    }
+    size_t length = total - offset;
+    if (params["length"].is<unsigned long>()) {
+        size_t requested = params["length"].as<unsigned long>();
+        if (requested < length) length = requested;
+    }
+    if (!entry->resource.binary) {
+        // Text ranges never split a character: both ends move back to the
+        // start of the character they fall in, and a range shorter than one
+        // character grows to cover it. _meta reports the adjusted range.
+        ResourceProvider& provider = *entry->resource.provider;
+        size_t end = offset + length;
+        if (offset < total) offset = utf8CharStart(provider, offset);
+        if (end < total && end > offset) {
+            size_t start = utf8CharStart(provider, end);
+            end = start > offset ? start : utf8NextStart(provider, end);
+        }
+        length = end - offset;
+    }
+
+    MCPResponse response(request.id(), 0);
+    const char* error = nullptr;
+    response.sent = streamResource(request.id(), entry->resource, offset, length, total, error);
+    if (!response.sent) {
+        return createJSONRPCError(static_cast<int>(ErrorCode::INTERNAL_ERROR), request.id(), error);
+    }
+    return response;
+}
+
+MCPResponse BLEMCPServer::handleResourcesSubscribe(MCPRequest& request, bool subscribe) {
+    JsonVariantConst params = request.params();
+
+    if (!params["uri"].is<const char*>()) {
+        return createJSONRPCError(static_cast<int>(ErrorCode::INVALID_PARAMS), request.id(), "Missing or invalid 'uri' parameter");
+    }
+    const char* uri = params["uri"];
+    ResourceEntry* entry = findResource(uri);
+    if (!entry) {
+        return createJSONRPCError(static_cast<int>(ErrorCode::RESOURCE_NOT_FOUND), request.id(),
+                                  std::string("Resource not found: ") + uri);
+    }
+
+    portENTER_CRITICAL(&notify_mux);
+    entry->subscribed = subscribe;
+    if (!subscribe) {
+        entry->pending = false;
+    }
+    portEXIT_CRITICAL(&notify_mux);
+
+    MCPResponse response(request.id(), 0);
+    response.resultDoc.to<JsonObject>();
+    return response;
+}
+
+bool BLEMCPServer::streamResource(JsonVariantConst id, const Resource& resource, size_t offset, size_t length,
+                                  size_t total, const char*& error) {
+    ResourceProvider& provider = *resource.provider;
+
+    std::string head = "{\"jsonrpc\":\"2.0\",\"id\":";
+    serializeJson(id, head);
+    head += ",\"result\":{\"contents\":[{\"uri\":\"";
+    appendEscaped(head, resource.uri.c_str());
+    head += "\"";
+    if (resource.mimeType.length() > 0) {
+        head += ",\"mimeType\":\"";
+        appendEscaped(head, resource.mimeType.c_str());
+        head += "\"";
+    }
+    head += resource.binary ? ",\"blob\":\"" : ",\"text\":\"";
+
+    char tail[96];
+    snprintf(tail, sizeof(tail), "\"}],\"_meta\":{\"offset\":%lu,\"length\":%lu,\"total\":%lu}}}",
+             (unsigned long)offset, (unsigned long)length, (unsigned long)total);
+    size_t tailLen = strlen(tail);
+
+    // 192 input bytes encode to exactly 256 base64 characters.
+    uint8_t in[192];
+    char out[256 + 8];
+    char escaped[7];
+
+    // Text needs a measuring pass: escaping changes the length, and the
+    // transport announces the total length up front. The pass also hashes
+    // the bytes, so content that changes before they are sent is noticed. A
+    // range that fits `in` is read once.
+    size_t bodyLen = 0;
+    uint32_t measured = 2166136261u;
+    const bool readOnce = !resource.binary && length <= sizeof(in);
+    if (resource.binary) {
+        bodyLen = (length + 2) / 3 * 4;
+    } else {
+        for (size_t done = 0; done < length;) {
+            size_t want = length - done < sizeof(in) ? length - done : sizeof(in);
+            size_t n = readResource(provider, offset + done, in, want);
+            if (n < want) {
+                error = "Resource changed during read";
+                return false;
+            }
+            for (size_t i = 0; i < n; i++) {
+                bodyLen += jsonEscape(in[i], escaped);
+            }
+            measured = hashBytes(measured, in, n);
+            done += n;
+        }
+    }
+
+    if (!mcp_transport_stream_begin(head.size() + bodyLen + tailLen)) {
+        error = "Transport not ready";
+        return false;
+    }
+    mcp_transport_stream_write((const uint8_t*)head.data(), head.size());
+
+    // Anything that does not match the announced length or the measured
+    // bytes aborts the message instead of sending padded or torn content.
+    bool intact = true;
+    size_t bodyLeft = bodyLen;
+    uint32_t sent = 2166136261u;
+    for (size_t done = 0; done < length && intact;) {
+        size_t want = length - done < sizeof(in) ? length - done : sizeof(in);
+        size_t n = readOnce ? want : readResource(provider, offset + done, in, want);
+        if (n < want) {
+            intact = false;
+            break;
+        }
+        size_t outLen = 0;
+        if (resource.binary) {
+            outLen = base64Encode(in, n, out);
+        } else {
+            sent = hashBytes(sent, in, n);
+            for (size_t i = 0; i < n && intact; i++) {
+                if (outLen > sizeof(out) - sizeof(escaped)) {
+                    intact = writeBody(out, outLen, bodyLeft);
+                    outLen = 0;
+                }
+                outLen += jsonEscape(in[i], out + outLen);
+            }
+        }
+        intact = intact && writeBody(out, outLen, bodyLeft);
+        done += n;
+    }
+    if (!intact || bodyLeft > 0 || (!resource.binary && sent != measured)) {
+        ESP_LOGE(TAG, "%s changed while it was sent", resource.uri.c_str());
+        mcp_transport_stream_abort();
+        error = "Resource changed during read";
+        return false;
+    }
+
+    mcp_transport_stream_write((const uint8_t*)tail, tailLen);
+    mcp_transport_stream_end();
+    return true;
+}
+
+// The result goes from the handler into toolResultDoc, is serialized into
+// toolText and escaped into txBuffer, all kept across calls, so a warmed-up
+// call to a handler implementing invokeInto() never touches the heap.
+// Errors take the usual MCPResponse path.
+bool BLEMCPServer::callTool(MCPRequest& request, const ToolEntry& tool, JsonVariantConst arguments) {
+    StreamingToolHandler* streaming = tool.toolHandler()->streaming();
+    if (streaming) {
+        return beginInput(request, tool, *streaming, arguments);
+    }
+
+    // Only validated arguments ever reach the cache, so hits skip validation.
+    // The epoch is read first: an invalidation while the handler runs makes
+    // the stored result stale.
+    uint32_t ttl = tool.cacheTtl();
+    uint32_t epoch = tool.cacheEpoch.value.load(std::memory_order_relaxed);
+    bool cacheable = ttl > 0 && toolCacheSize > 0 && measureJson(arguments) <= kMaxCachedArguments;
+    uint32_t cacheHash = 0;
+    if (cacheable) {
+        cacheKey = tool.toolName();
+        cacheKey += '\n';
+        serializeJson(arguments, cacheKey);
+        cacheHash = mcpHashString(cacheKey.c_str());
+        const std::string* cached = findCachedResult(cacheKey, cacheHash, epoch);
+        if (cached) {
+            trace(TraceStage::HANDLED, 0);
+            return sendToolResult(request, *cached);
+        }
+    }
+
+    SchemaValidator::Error validationError;
+    if (!tool.validator.validate(arguments, validationError) ||
+        !tool.toolHandler()->checkArguments(arguments, validationError)) {
+        return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::INVALID_PARAMS), request.id(),
+                                                   std::string("Invalid arguments: ") + validationError.message));
+    }
+
+    // The result document is reserved from the budget before the handler
+    // runs: a call that cannot fit is refused while it has no side effects.
+    if (toolResultCapacity > remainingBudget()) {
+        return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::SERVER_ERROR), request.id(),
+                                                   "Not enough memory for the tool result"));
+    }
+    chargeRequest(toolResultCapacity);
+    if (toolResultDoc.capacity() < toolResultCapacity) {
+        toolResultDoc = DynamicJsonDocument(toolResultCapacity);
+    } else {
+        toolResultDoc.clear();
+    }
+    InvokeCall call = {tool.toolHandler(), arguments, &toolResultDoc, false};
+    runTool(InvokeCall::run, &call);
+    bool fits = call.ok && !toolResultDoc.overflowed();
+    if (!fits) {
+        // Doubled for the next call, up to half the budget so that the
+        // reservation leaves room for the request and the response.
+        if (toolResultCapacity * 2 <= memoryBudget / 2) {
+            toolResultCapacity *= 2;
+        }
+        trace(TraceStage::HANDLED, 0);
+        sendToolError(request, "Tool result does not fit its document");
+        return true;
+    }
+    trace(TraceStage::HANDLED, 0);
+
+    toolText.clear();
+    serializeJson(toolResultDoc, toolText);
+    if (cacheable) {
+        storeCachedResult(cacheKey, cacheHash, epoch, ttl, toolText);
+    }
+    return sendToolResult(request, toolText);
+}
+
+// The text content result, laid out as serializeResponse() would.
+bool BLEMCPServer::sendToolResult(const MCPRequest& request, const std::string& text) {
+    if (!chargeRequest(text.size())) {
+        sendToolError(request, "Tool result exceeds the memory budget");
+        return false;
+    }
+    txBuffer.clear();
+    txBuffer.reserve(text.size() + text.size() / 8 + 96);
+    txBuffer += "{\"id\":";
+    serializeJson(request.id(), txBuffer);
+    finishToolResult(text.c_str(), false);
+    return true;
+}
 
-    String functionNameStr = String(functionName.c_str());
-    auto toolIt = tools.find(functionNameStr);
-    if (toolIt != tools.end()) {
-        if (toolIt->second.handler) {
-            DynamicJsonDocument argsDoc(4096);
-            argsDoc.set(arguments);
+// A tool-level error (isError) rather than a JSON-RPC one: the handler has
+// run, so the client must not take the call as not made and retry it. Not
+// stored for replay.
+void BLEMCPServer::sendToolError(const MCPRequest& request, const char* message) {
+    txBuffer.clear();
+    txBuffer += "{\"id\":";
+    serializeJson(request.id(), txBuffer);
+    finishToolResult(message, true);
+    txReplayable = false;
+}
 
-            DynamicJsonDocument resultDoc = toolIt->second.handler->call(argsDoc);
+void BLEMCPServer::finishToolResult(const char* text, bool isError) {
+    static const char kHead[] = ",\"jsonrpc\":\"2.0\",\"result\":{\"content\":[{\"type\":\"text\",\"text\":\"";
+    static const char kTail[] = "\"}]}}";
+    static const char kErrorTail[] = "\"}],\"isError\":true}}";
+    txBuffer.append(kHead, sizeof(kHead) - 1);
+    appendEscaped(txBuffer, text);
+    if (isError) {
+        txBuffer.append(kErrorTail, sizeof(kErrorTail) - 1);
+    } else {
+        txBuffer.append(kTail, sizeof(kTail) - 1);
+    }
+    trace(TraceStage::SERIALIZED, txBuffer.size());
+    chargeRequest(txBuffer.size());
+    sendResponse(txBuffer.c_str(), 200);
+}
 
-            String resultText;
-            serializeJson(resultDoc, resultText);
+// params.stream names the blob that will carry the input and its length.
+// The call is answered when the stream ends; until then the client is sent
+// notifications/stream/credit with how far it may send.
+bool BLEMCPServer::beginInput(MCPRequest& request, const ToolEntry& tool, StreamingToolHandler& handler,
+                              JsonVariantConst arguments) {
+    JsonVariantConst stream = request.params()["stream"];
+    if (!stream["blobId"].is<uint16_t>() || !stream["size"].is<uint32_t>()) {
+        return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::INVALID_PARAMS), request.id(),
+                                                   "Missing or invalid 'stream' parameter"));
+    }
+    if (input.handler) {
+        return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::SERVER_ERROR), request.id(),
+                                                   "Another stream is in progress"));
+    }
+    SchemaValidator::Error validationError;
+    if (!tool.validator.validate(arguments, validationError) ||
+        !tool.toolHandler()->checkArguments(arguments, validationError)) {
+        return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::INVALID_PARAMS), request.id(),
+                                                   std::string("Invalid arguments: ") + validationError.message));
+    }
+    if (!inputRing) {
+        inputRing.reset(new (std::nothrow) uint8_t[inputWindow]);
+        if (!inputRing) {
+            return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::SERVER_ERROR), request.id(),
+                                                       "No memory for the stream buffer"));
+        }
+    }
+    uint32_t size = stream["size"];
+    StreamBeginCall begin = {&handler, arguments, size, false};
+    runTool(StreamBeginCall::run, &begin);
+    if (!begin.ok) {
+        return respond(request, createJSONRPCError(static_cast<int>(ErrorCode::INVALID_PARAMS), request.id(),
+                                                   "Stream refused by the tool"));
+    }
+    trace(TraceStage::HANDLED, 0);
+
+    input.handler = &handler;
+    input.owner = tool.handler;
+    input.requestId.clear();
+    serializeJson(request.id(), input.requestId);
+    input.size = size;
+    input.credited = 0;
+    input.seenHead = 0;
+    input.progressMs = millis();
+    input.blobId = stream["blobId"];
+    inputHead.store(0);
+    inputTail.store(0);
+    inputBroken.store(false);
+    adoptInput();
+    if (size == 0) {
+        endInput(true);
+    } else {
+        sendCredit();
+    }
+    return true;
+}
 
-            JsonObject textContent = content.createNestedObject();
-            textContent["type"] = "text";
-            textContent["text"] = resultText;
-            return mcpResponse;
+// Frames of the stream that arrived before the call went to the blob store;
+// they move into the ring, and the stream is started under blob_lock so that
+// no frame in flight lands in the store afterwards.
+void BLEMCPServer::adoptInput() {
+    xSemaphoreTake(blob_lock, portMAX_DELAY);
+    for (auto it = rxBlobs.begin(); it != rxBlobs.end(); ++it) {
+        if (it->id != input.blobId) continue;
+        if (it->blob.size != input.size || it->received > inputWindow) {
+            inputBroken.store(true);
         } else {
-            return createJSONRPCError(static_cast<int>(ErrorCode::INTERNAL_ERROR), request.id(),
-                                      std::string("Tool handler not initialized: ") + functionNameStr.c_str());
+            memcpy(inputRing.get(), it->blob.data.get(), it->received);
+            inputHead.store(it->received);
+        }
+        rxBlobs.erase(it);
+        break;
+    }
+    inputActive.store(true);
+    xSemaphoreGive(blob_lock);
+}
+
+uint32_t BLEMCPServer::drainInput() {
+    if (!input.handler) return UINT32_MAX;
+    uint32_t tail = inputTail.load(std::memory_order_relaxed);
+    uint32_t head = inputHead.load(std::memory_order_acquire);
+    bool ok = !inputBroken.load() && head <= input.size;
+    if (head != input.seenHead || tail != head) {
+        input.seenHead = head;
+        input.progressMs = millis();
+    }
+    while (ok && tail != head) {
+        size_t at = tail % inputWindow;
+        size_t n = head - tail;
+        if (n > inputWindow - at) {
+            n = inputWindow - at;
         }
+        StreamChunkCall chunk = {input.handler, inputRing.get() + at, n, false};
+        runTool(StreamChunkCall::run, &chunk);
+        ok = chunk.ok;
+        tail += n;
+        inputTail.store(tail, std::memory_order_release);
+    }
+    uint32_t idleMs = millis() - input.progressMs;
+    if (ok && inputTimeoutMs > 0 && idleMs >= inputTimeoutMs) {
+        Serial.printf("Stream stalled for %lu ms\n", (unsigned long)idleMs);
+        ok = false;
+    }
+    if (!ok || tail == input.size) {
+        endInput(ok);
+        return UINT32_MAX;
+    }
+    if (tail - input.credited >= inputWindow / 2) {
+        sendCredit();
+    }
+    return inputTimeoutMs > 0 ? inputTimeoutMs - idleMs : UINT32_MAX;
+}
+
+// Answers the tools/call that started the stream.
+void BLEMCPServer::endInput(bool complete) {
+    inputActive.store(false);
+    StreamingToolHandler* handler = input.handler;
+    input.handler = nullptr;
+    requestBytes = 0;
+
+    if (toolResultDoc.capacity() < toolResultCapacity) {
+        toolResultDoc = DynamicJsonDocument(toolResultCapacity);
+    } else {
+        toolResultDoc.clear();
+    }
+    StreamEndCall end = {handler, complete, &toolResultDoc, false};
+    runTool(StreamEndCall::run, &end);
+    bool fits = end.ok && !toolResultDoc.overflowed();
+    const std::string& id = input.requestId;
+    if (!complete) {
+        Serial.printf("Stream aborted at %lu of %lu bytes\n", (unsigned long)inputTail.load(),
+                      (unsigned long)input.size);
+        sendScannedError(id.data(), id.size(), static_cast<int>(ErrorCode::INTERNAL_ERROR), "Stream aborted", "");
     } else {
-        return createJSONRPCError(static_cast<int>(ErrorCode::METHOD_NOT_FOUND), request.id(),
-                                  std::string("Method not supported: ") + functionNameStr.c_str());
+        // As in callTool(), a result that does not fit is a tool-level error.
+        if (fits) {
+            toolText.clear();
+            serializeJson(toolResultDoc, toolText);
+        }
+        txBuffer = "{\"id\":";
+        txBuffer += id;
+        finishToolResult(fits ? toolText.c_str() : "Tool result does not fit its document", !fits);
+    }
+    input.owner.reset();
+}
+
+void BLEMCPServer::sendCredit() {
+    input.credited = inputTail.load();
+    char message[160];
+    snprintf(message, sizeof(message),
+             "{\"jsonrpc\":\"2.0\",\"method\":\"notifications/stream/credit\",\"params\":{\"blobId\":%u,"
+             "\"received\":%lu,\"window\":%lu}}",
+             (unsigned)input.blobId, (unsigned long)input.credited, (unsigned long)inputWindow);
+    mcp_transport_send_message(message);
+}
+
+void BLEMCPServer::setStreamWindow(size_t bytes) {
+    if (inputRing || bytes == 0) return;  // fixed once allocated
+    inputWindow = bytes;
+}
+
+void BLEMCPServer::setStreamTimeout(uint32_t ms) {
+    inputTimeoutMs = ms;
+}
+
+// Stale entries are left in place for storeCachedResult() to overwrite.
+const std::string* BLEMCPServer::findCachedResult(const std::string& key, uint32_t hash, uint32_t epoch) {
+    for (auto it = toolCache.begin(); it != toolCache.end(); ++it) {
+        if (it->hash != hash || it->key != key) continue;
+        if (it->epoch != epoch || (int32_t)(it->expiresMs - millis()) <= 0) {
+            return nullptr;
+        }
+        std::rotate(toolCache.begin(), it, it + 1);
+        return &toolCache.front().text;
+    }
+    return nullptr;
+}
+
+// Overwrites the entry for the same key, else the least recently used one
+// once the cache is full, so the strings keep their capacity.
+void BLEMCPServer::storeCachedResult(const std::string& key, uint32_t hash, uint32_t epoch, uint32_t ttlMs,
+                                     const std::string& text) {
+    auto it = toolCache.begin();
+    while (it != toolCache.end() && (it->hash != hash || it->key != key)) {
+        ++it;
+    }
+    if (it == toolCache.end()) {
+        if (toolCache.size() < toolCacheSize) {
+            toolCache.emplace_back();
+        }
+        it = toolCache.end() - 1;
+    }
+    std::rotate(toolCache.begin(), it, it + 1);
+    CachedResult& entry = toolCache.front();
+    entry.hash = hash;
+    entry.epoch = epoch;
+    entry.expiresMs = millis() + ttlMs;
+    entry.key = key;
+    entry.text = text;
+}
+
+// Under tools_lock, so a table being copied cannot miss the new epoch.
+void BLEMCPServer::invalidateToolCache(const char* toolName) {
+    xSemaphoreTake(tools_lock, portMAX_DELAY);
+    const ToolTable* table = toolTable.load();
+    if (toolName) {
+        const ToolEntry* only = findTool(table, toolName);
+        if (only) {
+            only->cacheEpoch.value.store(++cacheEpochs, std::memory_order_relaxed);
+        }
+    } else if (table) {
+        for (const ToolEntry& entry : *table) {
+            entry.cacheEpoch.value.store(++cacheEpochs, std::memory_order_relaxed);
+        }
+    }
+    xSemaphoreGive(tools_lock);
+}
+
+void BLEMCPServer::setToolCacheSize(size_t entries) {
+    toolCacheSize = entries;
+    if (toolCache.size() > entries) {
+        toolCache.resize(entries);
     }
-    return mcpResponse;
 }
 
 MCPResponse BLEMCPServer::createJSONRPCError(int code, const JsonVariantConst& id, const std::string& message) {
-    MCPResponse response(id);
+    MCPResponse response(id, 0, JSON_OBJECT_SIZE(2) + message.size() + 1);
 
     response.errorDoc["code"] = code;
     response.errorDoc["message"] = message;
@@ -2,9 +2,7 @@
 
 class ServerCallbacks : public NimBLEServerCallbacks {
     void onConnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) override {
-        McpBle::getInstance()._onConnect(pServer);
-        // Update connection params for speed (min 7.5ms, max 15ms, latency 0, timeout 4000ms)
-        pServer->updateConnParams(desc->conn_handle, 6, 12, 0, 400);
+        McpBle::getInstance()._onConnect(pServer, desc->conn_handle);
     }
 
     void onDisconnect(NimBLEServer* pServer) override {
@@ -22,6 +20,37 @@ class CharCallbacks : public NimBLECharacteristicCallbacks {
     }
 };
 
+void McpLinkPolicy::setIdleTimeout(uint32_t ms) {
+    _idleTimeoutMs = ms;
+}
+
+void McpLinkPolicy::reset() {
+    _current = PROFILE_NONE;
+}
+
+McpLinkPolicy::Profile McpLinkPolicy::onActivity(uint32_t nowMs) {
+    _lastActivityMs = nowMs;
+    if (_current == PROFILE_FAST) {
+        return PROFILE_NONE;
+    }
+    _current = PROFILE_FAST;
+    return PROFILE_FAST;
+}
+
+McpLinkPolicy::Profile McpLinkPolicy::poll(uint32_t nowMs, uint32_t& waitMs) {
+    waitMs = UINT32_MAX;
+    if (_current != PROFILE_FAST || _idleTimeoutMs == 0) {
+        return PROFILE_NONE;
+    }
+    uint32_t idle = nowMs - _lastActivityMs;
+    if (idle < _idleTimeoutMs) {
+        waitMs = _idleTimeoutMs - idle;
+        return PROFILE_NONE;
+    }
+    _current = PROFILE_SLOW;
+    return PROFILE_SLOW;
+}
+
 McpBle& McpBle::getInstance() {
     static McpBle instance;
     return instance;
@@ -32,6 +61,11 @@ McpBle::McpBle() {}
 void McpBle::init(const std::string& deviceName) {
     NimBLEDevice::init(deviceName);
     NimBLEDevice::setPower(ESP_PWR_LVL_P9); 
+    // The client starts the MTU exchange; this is what we answer with.
+    NimBLEDevice::setMTU(_linkConfig.preferredMtu);
+    if (!_linkLock) {
+        _linkLock = xSemaphoreCreateMutex();
+    }
     
     _pServer = NimBLEDevice::createServer();
     _pServer->setCallbacks(new ServerCallbacks());
@@ -67,8 +101,13 @@ void McpBle::setMtuCallback(MtuCallback cb) {
     _mtuCallback = cb;
 }
 
+void McpBle::setConnectionCallback(ConnectionCallback cb) {
+    _connectionCallback = cb;
+}
+
 bool McpBle::sendNotification(const uint8_t* data, size_t len) {
     if (!_connected || !_pTxCharacteristic) return false;
+    noteActivity();
     _pTxCharacteristic->notify(data, len);
     return true;
 }
@@ -81,13 +120,88 @@ bool McpBle::isConnected() const {
     return _connected;
 }
 
-void McpBle::_onConnect(NimBLEServer* pServer) {
+void McpBle::setLinkConfig(const LinkConfig& config) {
+    _linkConfig = config;
+}
+
+const McpBle::LinkConfig& McpBle::getLinkConfig() const {
+    return _linkConfig;
+}
+
+McpLinkPolicy::Profile McpBle::getLinkProfile() const {
+    return _appliedProfile;
+}
+
+uint32_t McpBle::pollLink(uint32_t nowMs) {
+    if (!_connected) return UINT32_MAX;
+    uint32_t waitMs;
+    portENTER_CRITICAL(&_linkMux);
+    McpLinkPolicy::Profile next = _linkPolicy.poll(nowMs, waitMs);
+    portEXIT_CRITICAL(&_linkMux);
+    if (next != McpLinkPolicy::PROFILE_NONE) {
+        applyLinkProfile();
+    }
+    return waitMs;
+}
+
+// Called for every packet in either direction; only a switch back to the
+// fast profile costs more than the timestamp.
+void McpBle::noteActivity() {
+    uint32_t now = millis();
+    portENTER_CRITICAL(&_linkMux);
+    McpLinkPolicy::Profile next = _linkPolicy.onActivity(now);
+    portEXIT_CRITICAL(&_linkMux);
+    if (next != McpLinkPolicy::PROFILE_NONE) {
+        applyLinkProfile();
+    }
+}
+
+// Writes and notifications run on different tasks, so two switches can
+// race; re-reading the policy under the lock makes the last request the
+// current profile.
+void McpBle::applyLinkProfile() {
+    if (!_pServer || !_linkLock || xSemaphoreTake(_linkLock, portMAX_DELAY) != pdTRUE) return;
+    portENTER_CRITICAL(&_linkMux);
+    McpLinkPolicy::Profile profile = _linkPolicy.current();
+    portEXIT_CRITICAL(&_linkMux);
+    if (_connected && profile != _appliedProfile && profile != McpLinkPolicy::PROFILE_NONE) {
+        const LinkProfile& p = profile == McpLinkPolicy::PROFILE_FAST ? _linkConfig.fast : _linkConfig.slow;
+        _pServer->updateConnParams(_connHandle, p.minInterval, p.maxInterval, p.latency, p.timeout);
+        _appliedProfile = profile;
+    }
+    xSemaphoreGive(_linkLock);
+}
+
+void McpBle::_onConnect(NimBLEServer* pServer, uint16_t connHandle) {
     _connected = true;
+    _connHandle = connHandle;
+    _appliedProfile = McpLinkPolicy::PROFILE_NONE;
+    portENTER_CRITICAL(&_linkMux);
+    _linkPolicy.reset();
+    _linkPolicy.setIdleTimeout(_linkConfig.idleTimeoutMs);
+    portEXIT_CRITICAL(&_linkMux);
+    if (_pServer && _linkConfig.dataLengthExtension) {
+        _pServer->setDataLen(connHandle, 251);
+    }
+    if (_linkConfig.phy2M) {
+        // Fails harmlessly on controllers without 2M (the original ESP32).
+        ble_gap_set_prefered_le_phy(connHandle, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK,
+                                    BLE_GAP_LE_PHY_CODED_ANY);
+    }
+    // Connection setup and discovery start on the fast profile.
+    noteActivity();
+    if (_connectionCallback) {
+        _connectionCallback(true);
+    }
 }
 
 void McpBle::_onDisconnect(NimBLEServer* pServer) {
     _connected = false;
     _mtu = 23; // Reset MTU
+    _appliedProfile = McpLinkPolicy::PROFILE_NONE;
+    if (_connectionCallback) {
+        _connectionCallback(false);
+    }
     NimBLEDevice::startAdvertising();
 }
 
@@ -102,6 +216,7 @@ void McpBle::_onWrite(NimBLECharacteristic* pCharacteristic) {
     if (_rxCallback) {
         std::string value = pCharacteristic->getValue();
         if (!value.empty()) {
+            noteActivity();
             _rxCallback((const uint8_t*)value.data(), value.length());
         }
     }
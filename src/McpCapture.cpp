@@ -0,0 +1,177 @@
+#include "McpCapture.h"
+
+#include <new>
+
+#include "mcp_transport.h"
+
+namespace {
+
+const uint8_t kMagic[] = {'M', 'C', 'P', 'C', 1};
+const size_t kMaxHeader = 11;  // kind and two 5-byte varints
+
+McpCapture* s_active = nullptr;  // the capture the transport hook points at
+
+size_t putVarint(uint8_t* out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+}  // namespace
+
+McpCapture::McpCapture(size_t bytes) : ring(new (std::nothrow) uint8_t[bytes]), capacity(ring ? bytes : 0) {}
+
+McpCapture::~McpCapture() {
+    stop();
+}
+
+void McpCapture::start() {
+    s_active = this;
+    mcp_transport_set_capture_fn(McpCapture::onFrame, this);
+}
+
+void McpCapture::stop() {
+    if (s_active != this) return;
+    mcp_transport_set_capture_fn(NULL, NULL);
+    s_active = nullptr;
+}
+
+void McpCapture::clear() {
+    portENTER_CRITICAL(&mux);
+    head = tail = used = 0;
+    records = 0;
+    droppedFrames = 0;
+    portEXIT_CRITICAL(&mux);
+}
+
+void McpCapture::onFrame(int kind, const uint8_t* data, size_t len, void* ctx) {
+    static_cast<McpCapture*>(ctx)->record((uint8_t)kind, data, len);
+}
+
+// Called from the BLE task for received packets and from whichever task
+// sends; the copy is at most one packet.
+void McpCapture::record(uint8_t kind, const uint8_t* data, size_t len) {
+    uint32_t now = micros();
+    uint8_t header[kMaxHeader];
+    portENTER_CRITICAL(&mux);
+    size_t n = 0;
+    header[n++] = kind;
+    n += putVarint(header + n, records ? now - lastUs : 0);
+    n += putVarint(header + n, len);
+    if (saving || n + len > capacity) {
+        droppedFrames++;
+    } else {
+        while (capacity - used < n + len) {
+            dropOldest();
+        }
+        put(header, n);
+        put(data, len);
+        records++;
+        lastUs = now;
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+void McpCapture::put(const uint8_t* data, size_t len) {
+    if (len == 0) return;  // connect and disconnect records have no data
+    size_t first = len < capacity - head ? len : capacity - head;
+    memcpy(ring.get() + head, data, first);
+    memcpy(ring.get(), data + first, len - first);
+    head = (head + len) % capacity;
+    used += len;
+}
+
+uint8_t McpCapture::peek(size_t index) const {
+    return ring[index % capacity];
+}
+
+size_t McpCapture::readHeader(size_t at, uint8_t& kind, uint32_t& delta, uint32_t& len) const {
+    size_t n = 0;
+    kind = peek(at + n++);
+    uint32_t* fields[] = {&delta, &len};
+    for (uint32_t* field : fields) {
+        uint32_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            uint8_t byte = peek(at + n++);
+            value |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        *field = value;
+    }
+    return n;
+}
+
+void McpCapture::dropOldest() {
+    uint8_t kind;
+    uint32_t delta, len;
+    size_t n = readHeader(tail, kind, delta, len) + len;
+    tail = (tail + n) % capacity;
+    used -= n;
+    records--;
+    droppedFrames++;
+}
+
+// Recording pauses instead of holding the lock, so `write` may be slow.
+bool McpCapture::save(const Writer& write) {
+    portENTER_CRITICAL(&mux);
+    saving = true;
+    size_t at = tail;
+    size_t count = records;
+    portEXIT_CRITICAL(&mux);
+
+    bool ok = write(kMagic, sizeof(kMagic));
+    for (size_t i = 0; i < count && ok; i++) {
+        uint8_t kind;
+        uint32_t delta, len;
+        at += readHeader(at, kind, delta, len);
+        uint8_t header[kMaxHeader];
+        size_t n = 0;
+        header[n++] = kind;
+        n += putVarint(header + n, i == 0 ? 0 : delta);
+        n += putVarint(header + n, len);
+        ok = write(header, n);
+
+        at %= capacity;
+        size_t first = len < capacity - at ? len : capacity - at;
+        ok = ok && write(ring.get() + at, first) && (first == len || write(ring.get(), len - first));
+        at += len;
+    }
+
+    portENTER_CRITICAL(&mux);
+    saving = false;
+    portEXIT_CRITICAL(&mux);
+    return ok;
+}
+
+McpCaptureReader::McpCaptureReader(const uint8_t* data, size_t len)
+    : p(data + sizeof(kMagic)), end(data + len), ok(len >= sizeof(kMagic) && memcmp(data, kMagic, sizeof(kMagic)) == 0) {}
+
+bool McpCaptureReader::readVarint(uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool McpCaptureReader::next(Frame& frame) {
+    if (!ok || p >= end) return false;
+    frame.kind = *p++;
+    uint32_t delta, len;
+    if (!readVarint(delta) || !readVarint(len) || len > (size_t)(end - p)) {
+        ok = false;
+        return false;
+    }
+    timeUs += delta;
+    frame.timeUs = timeUs;
+    frame.data = p;
+    frame.len = len;
+    p += len;
+    return true;
+}
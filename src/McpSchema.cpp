@@ -0,0 +1,554 @@
+#include "McpSchema.h"
+
+#include <math.h>
+
+#include <vector>
+
+#include "BLEMCPServer.h"
+
+namespace {
+
+struct FlatSchemaBuilder {
+    std::vector<FlatSchema::Node> nodes;
+    std::vector<uint16_t> lists;
+    std::vector<char> strings;
+    bool ok = true;
+
+    // Optional attributes: absent or empty text is NONE.
+    uint16_t intern(const char* text) {
+        if (!text || !*text) return FlatSchema::NONE;
+        return internValue(text);
+    }
+
+    uint16_t intern(const String& value) {
+        return intern(value.c_str());
+    }
+
+    // Property names and list entries, which may be empty strings.
+    uint16_t internValue(const char* text) {
+        size_t len = strlen(text);
+        size_t offset = 0;
+        while (offset < strings.size()) {
+            const char* candidate = strings.data() + offset;
+            size_t candidateLen = strlen(candidate);
+            if (candidateLen == len && memcmp(candidate, text, len) == 0) {
+                return (uint16_t)offset;
+            }
+            offset += candidateLen + 1;
+        }
+        if (strings.size() + len + 1 >= FlatSchema::NONE) {
+            ok = false;
+            return FlatSchema::NONE;
+        }
+        strings.insert(strings.end(), text, text + len + 1);
+        return (uint16_t)offset;
+    }
+
+    void appendList(const std::vector<String>& values, uint8_t& count) {
+        if (values.size() > 0xFF) {
+            ok = false;
+            return;
+        }
+        count = (uint8_t)values.size();
+        for (const auto& value : values) {
+            lists.push_back(internValue(value.c_str()));
+        }
+    }
+
+    void append(const Properties& schema, uint8_t role, uint16_t key, uint8_t depth) {
+        if (!ok) return;
+        if (depth >= FlatSchema::MAX_DEPTH || nodes.size() >= FlatSchema::NONE - 1) {
+            ok = false;
+            return;
+        }
+
+        size_t index = nodes.size();
+        FlatSchema::Node node = {};
+        node.type = intern(schema.type);
+        node.title = intern(schema.title);
+        node.description = intern(schema.description);
+        node.format = intern(schema.format);
+        node.defaultValue = intern(schema.defaultValue);
+        node.key = key;
+        node.listStart = (uint16_t)lists.size();
+        node.role = role;
+        node.depth = depth;
+        appendList(schema.required, node.requiredCount);
+        appendList(schema.enumValues, node.enumCount);
+
+        if (!schema.properties.empty()) node.flags |= FlatSchema::HAS_PROPERTIES;
+        if (schema.items) node.flags |= FlatSchema::HAS_ITEMS;
+        if (!schema.oneOf.empty()) node.flags |= FlatSchema::HAS_ONE_OF;
+        if (!schema.anyOf.empty()) node.flags |= FlatSchema::HAS_ANY_OF;
+        if (!schema.allOf.empty()) node.flags |= FlatSchema::HAS_ALL_OF;
+        if (schema.hasAdditionalProperties) node.flags |= FlatSchema::HAS_ADDITIONAL_PROPERTIES;
+        if (schema.additionalProperties) node.flags |= FlatSchema::ADDITIONAL_PROPERTIES;
+        nodes.push_back(node);
+
+        // Children in the order toJson() creates their containers.
+        for (const auto& kv : schema.properties) {
+            append(kv.second, FlatSchema::ROLE_PROPERTY, internValue(kv.first.c_str()), depth + 1);
+        }
+        if (schema.items) {
+            append(*schema.items, FlatSchema::ROLE_ITEMS, FlatSchema::NONE, depth + 1);
+        }
+        for (const auto& sub : schema.oneOf) {
+            append(sub, FlatSchema::ROLE_ONE_OF, FlatSchema::NONE, depth + 1);
+        }
+        for (const auto& sub : schema.anyOf) {
+            append(sub, FlatSchema::ROLE_ANY_OF, FlatSchema::NONE, depth + 1);
+        }
+        for (const auto& sub : schema.allOf) {
+            append(sub, FlatSchema::ROLE_ALL_OF, FlatSchema::NONE, depth + 1);
+        }
+        nodes[index].end = (uint16_t)nodes.size();
+    }
+
+    uint8_t appendStrings(JsonArrayConst values) {
+        uint8_t count = 0;
+        for (JsonVariantConst value : values) {
+            // Only string values can be matched; reject rather than drop the rest.
+            if (!value.is<const char*>() || count == 0xFF) {
+                ok = false;
+                break;
+            }
+            lists.push_back(internValue(value.as<const char*>()));
+            count++;
+        }
+        return count;
+    }
+
+    void appendJson(JsonObjectConst schema, uint8_t role, uint16_t key, uint8_t depth) {
+        if (!ok) return;
+        if (depth >= FlatSchema::MAX_DEPTH || nodes.size() >= FlatSchema::NONE - 1) {
+            ok = false;
+            return;
+        }
+
+        size_t index = nodes.size();
+        FlatSchema::Node node = {};
+        node.type = intern(schema["type"].as<const char*>());
+        node.title = intern(schema["title"].as<const char*>());
+        node.description = intern(schema["description"].as<const char*>());
+        node.format = intern(schema["format"].as<const char*>());
+        node.defaultValue = intern(schema["default"].as<const char*>());
+        node.key = key;
+        node.listStart = (uint16_t)lists.size();
+        node.role = role;
+        node.depth = depth;
+        node.requiredCount = appendStrings(schema["required"]);
+        node.enumCount = appendStrings(schema["enum"]);
+
+        JsonObjectConst properties = schema["properties"];
+        JsonObjectConst items = schema["items"];
+        JsonArrayConst oneOf = schema["oneOf"];
+        JsonArrayConst anyOf = schema["anyOf"];
+        JsonArrayConst allOf = schema["allOf"];
+        JsonVariantConst additional = schema["additionalProperties"];
+
+        if (!properties.isNull() && properties.size() > 0) node.flags |= FlatSchema::HAS_PROPERTIES;
+        if (!items.isNull()) node.flags |= FlatSchema::HAS_ITEMS;
+        if (oneOf.size() > 0) node.flags |= FlatSchema::HAS_ONE_OF;
+        if (anyOf.size() > 0) node.flags |= FlatSchema::HAS_ANY_OF;
+        if (allOf.size() > 0) node.flags |= FlatSchema::HAS_ALL_OF;
+        if (additional.is<bool>()) node.flags |= FlatSchema::HAS_ADDITIONAL_PROPERTIES;
+        if (!additional.is<bool>() || additional.as<bool>()) node.flags |= FlatSchema::ADDITIONAL_PROPERTIES;
+        nodes.push_back(node);
+
+        for (JsonPairConst kv : properties) {
+            appendJson(kv.value(), FlatSchema::ROLE_PROPERTY, internValue(kv.key().c_str()), depth + 1);
+        }
+        if (!items.isNull()) {
+            appendJson(items, FlatSchema::ROLE_ITEMS, FlatSchema::NONE, depth + 1);
+        }
+        for (JsonVariantConst sub : oneOf) {
+            appendJson(sub, FlatSchema::ROLE_ONE_OF, FlatSchema::NONE, depth + 1);
+        }
+        for (JsonVariantConst sub : anyOf) {
+            appendJson(sub, FlatSchema::ROLE_ANY_OF, FlatSchema::NONE, depth + 1);
+        }
+        for (JsonVariantConst sub : allOf) {
+            appendJson(sub, FlatSchema::ROLE_ALL_OF, FlatSchema::NONE, depth + 1);
+        }
+        nodes[index].end = (uint16_t)nodes.size();
+    }
+
+    // Packs nodes, lists and strings into one arena: [T...][uint16_t...][char...].
+    template <typename T>
+    std::unique_ptr<uint8_t[]> pack(const std::vector<T>& items, size_t& arenaSize) const {
+        size_t itemsSize = items.size() * sizeof(T);
+        size_t listsSize = lists.size() * sizeof(uint16_t);
+        arenaSize = itemsSize + listsSize + strings.size();
+        std::unique_ptr<uint8_t[]> arena(new uint8_t[arenaSize]);
+        if (itemsSize) {
+            memcpy(arena.get(), items.data(), itemsSize);
+        }
+        if (listsSize) {
+            memcpy(arena.get() + itemsSize, lists.data(), listsSize);
+        }
+        if (!strings.empty()) {
+            memcpy(arena.get() + itemsSize + listsSize, strings.data(), strings.size());
+        }
+        return arena;
+    }
+};
+
+uint8_t typeMask(const char* type) {
+    if (!type) return 0;
+    if (strcmp(type, "string") == 0) return SchemaValidator::TYPE_STRING;
+    if (strcmp(type, "object") == 0) return SchemaValidator::TYPE_OBJECT;
+    if (strcmp(type, "integer") == 0) return SchemaValidator::TYPE_INTEGER;
+    if (strcmp(type, "number") == 0) return SchemaValidator::TYPE_INTEGER | SchemaValidator::TYPE_NUMBER;
+    if (strcmp(type, "boolean") == 0) return SchemaValidator::TYPE_BOOLEAN;
+    if (strcmp(type, "array") == 0) return SchemaValidator::TYPE_ARRAY;
+    if (strcmp(type, "null") == 0) return SchemaValidator::TYPE_NULL;
+    return 0;
+}
+
+uint8_t typeOf(JsonVariantConst value) {
+    if (value.isNull()) return SchemaValidator::TYPE_NULL;
+    if (value.is<bool>()) return SchemaValidator::TYPE_BOOLEAN;
+    if (value.is<const char*>()) return SchemaValidator::TYPE_STRING;
+    if (value.is<JsonObjectConst>()) return SchemaValidator::TYPE_OBJECT;
+    if (value.is<JsonArrayConst>()) return SchemaValidator::TYPE_ARRAY;
+    if (value.is<long>()) return SchemaValidator::TYPE_INTEGER;
+    double number = value.as<double>();
+    // The cast is undefined outside the long long range, where every double
+    // is integral anyway. JSON has no NaN or infinity.
+    if (!(fabs(number) < 9223372036854775808.0)) return SchemaValidator::TYPE_INTEGER;
+    return number == (double)(long long)number ? SchemaValidator::TYPE_INTEGER : SchemaValidator::TYPE_NUMBER;
+}
+
+const char* typeName(uint8_t mask) {
+    if (mask & SchemaValidator::TYPE_STRING) return "string";
+    if (mask & SchemaValidator::TYPE_OBJECT) return "object";
+    if (mask & SchemaValidator::TYPE_NUMBER) return "number";
+    if (mask & SchemaValidator::TYPE_INTEGER) return "integer";
+    if (mask & SchemaValidator::TYPE_BOOLEAN) return "boolean";
+    if (mask & SchemaValidator::TYPE_ARRAY) return "array";
+    return "null";
+}
+
+// ArduinoJson links const char* values and copies char* ones.
+template <typename TDestination>
+void setText(TDestination destination, const char* value, bool copy) {
+    if (copy) {
+        destination.set(const_cast<char*>(value));
+    } else {
+        destination.set(value);
+    }
+}
+
+void addText(JsonArray& array, const char* value, bool copy) {
+    if (copy) {
+        array.add(const_cast<char*>(value));
+    } else {
+        array.add(value);
+    }
+}
+
+}  // namespace
+
+FlatSchema::FlatSchema(const FlatSchema& other) {
+    *this = other;
+}
+
+FlatSchema& FlatSchema::operator=(const FlatSchema& other) {
+    if (this != &other) {
+        arena.reset(other.arenaSize ? new uint8_t[other.arenaSize] : nullptr);
+        if (other.arenaSize) {
+            memcpy(arena.get(), other.arena.get(), other.arenaSize);
+        }
+        arenaSize = other.arenaSize;
+        nodeCount = other.nodeCount;
+        listCount = other.listCount;
+    }
+    return *this;
+}
+
+FlatSchema::FlatSchema(FlatSchema&& other) noexcept {
+    *this = std::move(other);
+}
+
+FlatSchema& FlatSchema::operator=(FlatSchema&& other) noexcept {
+    if (this != &other) {
+        arena = std::move(other.arena);
+        arenaSize = other.arenaSize;
+        nodeCount = other.nodeCount;
+        listCount = other.listCount;
+        other.arenaSize = 0;
+        other.nodeCount = 0;
+        other.listCount = 0;
+    }
+    return *this;
+}
+
+bool FlatSchema::build(const Properties& schema) {
+    FlatSchemaBuilder builder;
+    builder.append(schema, ROLE_ROOT, NONE, 0);
+    if (!builder.ok) {
+        return false;
+    }
+    arena = builder.pack(builder.nodes, arenaSize);
+    nodeCount = (uint16_t)builder.nodes.size();
+    listCount = (uint16_t)builder.lists.size();
+    return true;
+}
+
+bool FlatSchema::build(JsonVariantConst schema) {
+    if (!schema.is<JsonObjectConst>()) {
+        return false;
+    }
+    FlatSchemaBuilder builder;
+    builder.appendJson(schema, ROLE_ROOT, NONE, 0);
+    if (!builder.ok) {
+        return false;
+    }
+    arena = builder.pack(builder.nodes, arenaSize);
+    nodeCount = (uint16_t)builder.nodes.size();
+    listCount = (uint16_t)builder.lists.size();
+    return true;
+}
+
+void FlatSchema::toJson(JsonObject& obj, bool copyStrings) const {
+    // Nodes are in pre-order, so a node's parent is always the most recent
+    // node one level up. Containers are created when the parent is visited,
+    // which keeps the key order of a Properties tree.
+    JsonObject path[MAX_DEPTH];
+    const Node* all = nodes();
+
+    for (uint16_t i = 0; i < nodeCount; i++) {
+        const Node& node = all[i];
+        JsonObject target;
+        if (node.depth == 0) {
+            target = obj;
+        } else {
+            JsonObject parent = path[node.depth - 1];
+            switch (node.role) {
+                case ROLE_PROPERTY: {
+                    JsonObject properties = parent["properties"].as<JsonObject>();
+                    target = copyStrings ? properties[const_cast<char*>(str(node.key))].to<JsonObject>()
+                                         : properties[str(node.key)].to<JsonObject>();
+                    break;
+                }
+                case ROLE_ITEMS:
+                    target = parent["items"].as<JsonObject>();
+                    break;
+                case ROLE_ONE_OF:
+                    target = parent["oneOf"].as<JsonArray>().createNestedObject();
+                    break;
+                case ROLE_ANY_OF:
+                    target = parent["anyOf"].as<JsonArray>().createNestedObject();
+                    break;
+                default:
+                    target = parent["allOf"].as<JsonArray>().createNestedObject();
+                    break;
+            }
+        }
+        path[node.depth] = target;
+
+        setText(target["type"], node.type == NONE ? "" : str(node.type), copyStrings);
+        if (node.title != NONE) setText(target["title"], str(node.title), copyStrings);
+        if (node.description != NONE) setText(target["description"], str(node.description), copyStrings);
+        if (node.flags & HAS_PROPERTIES) target["properties"].to<JsonObject>();
+        if (node.requiredCount) {
+            JsonArray requiredArray = target["required"].to<JsonArray>();
+            for (uint8_t r = 0; r < node.requiredCount; r++) {
+                addText(requiredArray, listStr(node.listStart + r), copyStrings);
+            }
+        }
+        if (node.flags & HAS_ADDITIONAL_PROPERTIES) {
+            target["additionalProperties"] = (node.flags & ADDITIONAL_PROPERTIES) != 0;
+        }
+        if (node.flags & HAS_ITEMS) target["items"].to<JsonObject>();
+        if (node.enumCount) {
+            JsonArray enumArray = target["enum"].to<JsonArray>();
+            for (uint8_t e = 0; e < node.enumCount; e++) {
+                addText(enumArray, listStr(node.listStart + node.requiredCount + e), copyStrings);
+            }
+        }
+        if (node.flags & HAS_ONE_OF) target["oneOf"].to<JsonArray>();
+        if (node.flags & HAS_ANY_OF) target["anyOf"].to<JsonArray>();
+        if (node.flags & HAS_ALL_OF) target["allOf"].to<JsonArray>();
+        if (node.format != NONE) setText(target["format"], str(node.format), copyStrings);
+        if (node.defaultValue != NONE) setText(target["default"], str(node.defaultValue), copyStrings);
+    }
+}
+
+String FlatSchema::toString() const {
+    DynamicJsonDocument doc(4096);
+    JsonObject obj = doc.to<JsonObject>();
+    toJson(obj);
+    String result;
+    serializeJson(doc, result);
+    return result;
+}
+
+SchemaValidator::SchemaValidator(const SchemaValidator& other) {
+    *this = other;
+}
+
+SchemaValidator& SchemaValidator::operator=(const SchemaValidator& other) {
+    if (this != &other) {
+        arena.reset(other.arenaSize ? new uint8_t[other.arenaSize] : nullptr);
+        if (other.arenaSize) {
+            memcpy(arena.get(), other.arena.get(), other.arenaSize);
+        }
+        arenaSize = other.arenaSize;
+        opCount = other.opCount;
+        listCount = other.listCount;
+    }
+    return *this;
+}
+
+SchemaValidator::SchemaValidator(SchemaValidator&& other) noexcept {
+    *this = std::move(other);
+}
+
+SchemaValidator& SchemaValidator::operator=(SchemaValidator&& other) noexcept {
+    if (this != &other) {
+        arena = std::move(other.arena);
+        arenaSize = other.arenaSize;
+        opCount = other.opCount;
+        listCount = other.listCount;
+        other.arenaSize = 0;
+        other.opCount = 0;
+        other.listCount = 0;
+    }
+    return *this;
+}
+
+void SchemaValidator::compile(const FlatSchema& schema) {
+    FlatSchemaBuilder builder;
+    std::vector<Op> program;
+    program.reserve(schema.size());
+
+    for (uint16_t i = 0; i < schema.size(); i++) {
+        const FlatSchema::Node& node = schema.node(i);
+        Op op = {};
+        op.types = typeMask(schema.str(node.type));
+        op.flags = node.flags;
+        op.role = node.role;
+        op.requiredCount = node.requiredCount;
+        op.enumCount = node.enumCount;
+        op.key = node.key == FlatSchema::NONE ? FlatSchema::NONE : builder.internValue(schema.str(node.key));
+        op.end = node.end;
+        op.listStart = (uint16_t)builder.lists.size();
+        for (uint16_t l = 0; l < node.requiredCount + node.enumCount; l++) {
+            builder.lists.push_back(builder.internValue(schema.listStr(node.listStart + l)));
+        }
+        program.push_back(op);
+    }
+
+    arena = builder.pack(program, arenaSize);
+    opCount = (uint16_t)program.size();
+    listCount = (uint16_t)builder.lists.size();
+}
+
+bool SchemaValidator::validate(JsonVariantConst arguments, Error& error) const {
+    error.message[0] = '\0';
+    if (opCount == 0) {
+        return true;
+    }
+    if (arguments.isNull() && (ops()[0].types & TYPE_OBJECT)) {
+        // Clients may omit "arguments" entirely; only required names matter then.
+        if (ops()[0].requiredCount > 0) {
+            snprintf(error.message, sizeof(error.message), "missing required property '%s'",
+                     strings() + lists()[ops()[0].listStart]);
+            return false;
+        }
+        return true;
+    }
+    return validateOp(0, arguments, "arguments", &error);
+}
+
+uint16_t SchemaValidator::findChild(uint16_t index, uint8_t role, const char* key) const {
+    const Op* program = ops();
+    for (uint16_t child = index + 1; child < program[index].end; child = program[child].end) {
+        if (program[child].role != role) continue;
+        if (!key) return child;
+        if (program[child].key != FlatSchema::NONE && strcmp(strings() + program[child].key, key) == 0) {
+            return child;
+        }
+    }
+    return FlatSchema::NONE;
+}
+
+// Recursion is bounded by FlatSchema::MAX_DEPTH. `error` is null while
+// probing oneOf/anyOf branches so failed branches do not format messages.
+bool SchemaValidator::validateOp(uint16_t index, JsonVariantConst value, const char* name, Error* error) const {
+    const Op& op = ops()[index];
+    const uint16_t* list = lists() + op.listStart;
+    const char* pool = strings();
+
+    if (op.types && !(op.types & typeOf(value))) {
+        if (error) snprintf(error->message, sizeof(error->message), "'%s' must be %s", name, typeName(op.types));
+        return false;
+    }
+
+    if (op.enumCount) {
+        const char* text = value.as<const char*>();
+        bool found = false;
+        for (uint8_t e = 0; text && e < op.enumCount && !found; e++) {
+            found = strcmp(pool + list[op.requiredCount + e], text) == 0;
+        }
+        if (!found) {
+            if (error) snprintf(error->message, sizeof(error->message), "'%s' is not an allowed value", name);
+            return false;
+        }
+    }
+
+    if (value.is<JsonObjectConst>()) {
+        JsonObjectConst obj = value.as<JsonObjectConst>();
+        for (uint8_t r = 0; r < op.requiredCount; r++) {
+            if (!obj.containsKey(pool + list[r])) {
+                if (error) snprintf(error->message, sizeof(error->message), "missing required property '%s'", pool + list[r]);
+                return false;
+            }
+        }
+        bool closed = (op.flags & FlatSchema::HAS_ADDITIONAL_PROPERTIES) && !(op.flags & FlatSchema::ADDITIONAL_PROPERTIES);
+        if ((op.flags & FlatSchema::HAS_PROPERTIES) || closed) {
+            for (JsonPairConst kv : obj) {
+                const char* key = kv.key().c_str();
+                uint16_t child = findChild(index, FlatSchema::ROLE_PROPERTY, key);
+                if (child != FlatSchema::NONE) {
+                    if (!validateOp(child, kv.value(), key, error)) return false;
+                } else if (closed) {
+                    if (error) snprintf(error->message, sizeof(error->message), "unexpected property '%s'", key);
+                    return false;
+                }
+            }
+        }
+    }
+
+    if ((op.flags & FlatSchema::HAS_ITEMS) && value.is<JsonArrayConst>()) {
+        uint16_t items = findChild(index, FlatSchema::ROLE_ITEMS, nullptr);
+        for (JsonVariantConst element : value.as<JsonArrayConst>()) {
+            if (!validateOp(items, element, name, error)) return false;
+        }
+    }
+
+    if (op.flags & (FlatSchema::HAS_ONE_OF | FlatSchema::HAS_ANY_OF | FlatSchema::HAS_ALL_OF)) {
+        uint8_t oneOfMatches = 0;
+        bool anyOfMatched = false;
+        for (uint16_t child = index + 1; child < op.end; child = ops()[child].end) {
+            uint8_t role = ops()[child].role;
+            if (role == FlatSchema::ROLE_ALL_OF) {
+                if (!validateOp(child, value, name, error)) return false;
+            } else if (role == FlatSchema::ROLE_ONE_OF) {
+                if (validateOp(child, value, name, nullptr)) oneOfMatches++;
+            } else if (role == FlatSchema::ROLE_ANY_OF && !anyOfMatched) {
+                anyOfMatched = validateOp(child, value, name, nullptr);
+            }
+        }
+        if ((op.flags & FlatSchema::HAS_ONE_OF) && oneOfMatches != 1) {
+            if (error) snprintf(error->message, sizeof(error->message), "'%s' must match exactly one schema in oneOf", name);
+            return false;
+        }
+        if ((op.flags & FlatSchema::HAS_ANY_OF) && !anyOfMatched) {
+            if (error) snprintf(error->message, sizeof(error->message), "'%s' must match a schema in anyOf", name);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+#include "McpToolArgs.h"
+
+namespace {
+
+const char* schemaType(ToolArgType type) {
+    switch (type) {
+        case ToolArgType::BOOL:
+            return "boolean";
+        case ToolArgType::INT:
+        case ToolArgType::LONG:
+            return "integer";
+        case ToolArgType::FLOAT:
+        case ToolArgType::DOUBLE:
+            return "number";
+        default:
+            return "string";
+    }
+}
+
+void assign(const ToolArgField& field, JsonVariantConst value, uint8_t* base) {
+    void* target = base + field.offset;
+    switch (field.type) {
+        case ToolArgType::BOOL:
+            *static_cast<bool*>(target) = value.as<bool>();
+            break;
+        case ToolArgType::INT:
+            *static_cast<int*>(target) = value.as<int>();
+            break;
+        case ToolArgType::LONG:
+            *static_cast<long*>(target) = value.as<long>();
+            break;
+        case ToolArgType::FLOAT:
+            *static_cast<float*>(target) = value.as<float>();
+            break;
+        case ToolArgType::DOUBLE:
+            *static_cast<double*>(target) = value.as<double>();
+            break;
+        case ToolArgType::C_STRING:
+            *static_cast<const char**>(target) = value.as<const char*>();
+            break;
+        case ToolArgType::STRING:
+            *static_cast<String*>(target) = value.as<const char*>();
+            break;
+    }
+}
+
+}  // namespace
+
+void decodeToolArgs(JsonVariantConst arguments, const ToolArgField* fields, size_t count, void* out) {
+    uint8_t* base = static_cast<uint8_t*>(out);
+    for (JsonPairConst kv : arguments.as<JsonObjectConst>()) {
+        const char* key = kv.key().c_str();
+        for (size_t i = 0; i < count; i++) {
+            if (strcmp(fields[i].name, key) == 0) {
+                if (!kv.value().isNull()) {
+                    assign(fields[i], kv.value(), base);
+                }
+                break;
+            }
+        }
+    }
+}
+
+bool checkToolArgs(JsonVariantConst arguments, const ToolArgField* fields, size_t count,
+                   SchemaValidator::Error& error) {
+    for (JsonPairConst kv : arguments.as<JsonObjectConst>()) {
+        const char* key = kv.key().c_str();
+        for (size_t i = 0; i < count; i++) {
+            if (strcmp(fields[i].name, key) != 0) continue;
+            JsonVariantConst value = kv.value();
+            const char* type = nullptr;
+            if (fields[i].type == ToolArgType::INT && !value.isNull() && !value.is<int>()) {
+                type = "int";
+            } else if (fields[i].type == ToolArgType::LONG && !value.isNull() && !value.is<long>()) {
+                type = "long";
+            }
+            if (type) {
+                snprintf(error.message, sizeof(error.message), "'%s' is out of range for %s", key, type);
+                return false;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+Properties buildToolArgsSchema(const ToolArgField* fields, size_t count) {
+    Properties schema;
+    schema.type = "object";
+    for (size_t i = 0; i < count; i++) {
+        Properties property;
+        property.type = schemaType(fields[i].type);
+        if (fields[i].description) {
+            property.description = fields[i].description;
+        }
+        schema.properties[fields[i].name] = std::move(property);
+        if (fields[i].required) {
+            schema.required.push_back(fields[i].name);
+        }
+    }
+    return schema;
+}
@@ -21,6 +21,11 @@
 #define TYPE_CONT   0x80
 #define TYPE_END    0xC0
 
+/* Blob frames, see mcp_transport.h. */
+#define BLOB_MARKER      0x00
+#define BLOB_FLAG_FIRST  0x01
+#define BLOB_HEADER_LEN  5  /* frame header, marker, flags, id */
+
 static uint8_t *rx_buffer = NULL;
 static uint8_t *tx_buffer = NULL;
 static size_t rx_received_len = 0;
@@ -28,6 +33,12 @@ static size_t rx_total_len = 0;
 static uint8_t rx_expect_seq_id = 0;
 static bool rx_in_progress = false;
 
+static bool rx_blob_active = false;
+static uint16_t rx_blob_id = 0;
+static uint32_t rx_blob_total = 0;
+static uint32_t rx_blob_offset = 0;
+static uint8_t rx_blob_expect_seq = 0;
+
 static mcp_transport_send_fn_t s_send_fn = NULL;
 static void *s_send_ctx = NULL;
 static mcp_transport_message_cb_t s_message_cb = NULL;
@@ -38,12 +49,30 @@ static mcp_transport_log_fn_t s_log_fn = NULL;
 static void *s_log_ctx = NULL;
 static mcp_transport_lock_fn_t s_lock_fn = NULL;
 static void *s_lock_ctx = NULL;
+static mcp_transport_trace_fn_t s_trace_fn = NULL;
+static void *s_trace_ctx = NULL;
+static mcp_transport_capture_fn_t s_capture_fn = NULL;
+static void *s_capture_ctx = NULL;
+static mcp_transport_blob_cb_t s_blob_cb = NULL;
+static void *s_blob_ctx = NULL;
 static uint16_t s_mtu = DEFAULT_MTU;
 static uint32_t s_tx_gap_ticks = 0;
 static uint8_t s_send_max_retries = 3;
 static uint32_t s_send_retry_delay_ticks = 1;
 static bool s_initialized = false;
 
+/* Streaming TX state: one message is sent packet by packet as bytes arrive. */
+static bool s_stream_active = false;
+static bool s_stream_failed = false;
+static size_t s_stream_total = 0;
+static size_t s_stream_offset = 0;
+static size_t s_stream_packet_max = 0;
+static size_t s_stream_fill = 0;
+static size_t s_stream_packet_end = 0;
+static uint8_t s_stream_seq = 0;
+static bool s_stream_blob = false;
+static uint16_t s_stream_blob_id = 0;
+
 static void mcp_transport_logf(int level, const char *fmt, ...) {
     if (!s_log_fn) {
         return;
@@ -79,12 +108,14 @@ static bool mcp_transport_send_packet(const uint8_t *data, size_t len) {
     for (uint8_t attempt = 0; attempt <= s_send_max_retries; attempt++) {
         int rc = s_send_fn(data, len, s_send_ctx);
         if (rc == 0) {
+            if (s_capture_fn) s_capture_fn(MCP_TRANSPORT_CAPTURE_TX, data, len, s_capture_ctx);
             return true;
         }
         if (attempt < s_send_max_retries && s_send_retry_delay_ticks > 0 && s_sleep_fn) {
             s_sleep_fn(s_send_retry_delay_ticks, s_sleep_ctx);
         }
     }
+    if (s_capture_fn) s_capture_fn(MCP_TRANSPORT_CAPTURE_TX_FAILED, data, len, s_capture_ctx);
     return false;
 }
 
@@ -123,6 +154,7 @@ void mcp_transport_deinit(void) {
     rx_total_len = 0;
     rx_expect_seq_id = 0;
     rx_in_progress = false;
+    rx_blob_active = false;
 
     s_initialized = false;
 }
@@ -152,8 +184,35 @@ void mcp_transport_set_lock_fn(mcp_transport_lock_fn_t fn, void *ctx) {
     s_lock_ctx = ctx;
 }
 
+void mcp_transport_set_trace_fn(mcp_transport_trace_fn_t fn, void *ctx) {
+    s_trace_fn = fn;
+    s_trace_ctx = ctx;
+}
+
+void mcp_transport_set_capture_fn(mcp_transport_capture_fn_t fn, void *ctx) {
+    s_capture_fn = fn;
+    s_capture_ctx = ctx;
+}
+
+void mcp_transport_set_blob_cb(mcp_transport_blob_cb_t cb, void *ctx) {
+    s_blob_cb = cb;
+    s_blob_ctx = ctx;
+}
+
 void mcp_transport_set_mtu(uint16_t mtu) {
     s_mtu = mtu ? mtu : DEFAULT_MTU;
+    if (s_capture_fn) {
+        uint8_t value[2] = {(uint8_t)(s_mtu >> 8), (uint8_t)(s_mtu & 0xFF)};
+        s_capture_fn(MCP_TRANSPORT_CAPTURE_MTU, value, sizeof(value), s_capture_ctx);
+    }
+}
+
+/* Only recorded; the link layer owns the connection. */
+void mcp_transport_connection_changed(bool connected) {
+    if (s_capture_fn) {
+        s_capture_fn(connected ? MCP_TRANSPORT_CAPTURE_CONNECT : MCP_TRANSPORT_CAPTURE_DISCONNECT, NULL, 0,
+                     s_capture_ctx);
+    }
 }
 
 void mcp_transport_set_tx_gap_ticks(uint32_t gap_ticks) {
@@ -165,7 +224,56 @@ void mcp_transport_set_send_retry(uint8_t max_retries, uint32_t retry_delay_tick
     s_send_retry_delay_ticks = retry_delay_ticks;
 }
 
+static void mcp_transport_abandon_blob(const char *reason) {
+    mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Blob %u: %s", (unsigned)rx_blob_id, reason);
+    if (rx_blob_active && s_blob_cb) {
+        s_blob_cb(rx_blob_id, rx_blob_total, rx_blob_offset, NULL, 0, s_blob_ctx);
+    }
+    rx_blob_active = false;
+}
+
+/* Each frame is handed on as it arrives; nothing is buffered here. */
+static void mcp_transport_receive_blob(uint8_t seq_id, const uint8_t *payload, size_t payload_len) {
+    if (payload_len < BLOB_HEADER_LEN - 1) return;
+    uint8_t flags = payload[1];
+    uint16_t blob_id = (uint16_t)((payload[2] << 8) | payload[3]);
+    payload += BLOB_HEADER_LEN - 1;
+    payload_len -= BLOB_HEADER_LEN - 1;
+
+    if (flags & BLOB_FLAG_FIRST) {
+        if (payload_len < 4) return;
+        if (rx_blob_active) {
+            mcp_transport_abandon_blob("Interrupted");
+        }
+        rx_blob_total = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) | ((uint32_t)payload[2] << 8) |
+                        payload[3];
+        rx_blob_id = blob_id;
+        rx_blob_offset = 0;
+        rx_blob_active = true;
+        payload += 4;
+        payload_len -= 4;
+    } else if (!rx_blob_active || blob_id != rx_blob_id) {
+        return;
+    } else if (seq_id != rx_blob_expect_seq) {
+        mcp_transport_abandon_blob("Sequence mismatch");
+        return;
+    }
+    if (payload_len > rx_blob_total - rx_blob_offset) {
+        mcp_transport_abandon_blob("Overflow");
+        return;
+    }
+    rx_blob_expect_seq = (uint8_t)((seq_id + 1) & HEADER_SEQ_MASK);
+    if (s_blob_cb) {
+        s_blob_cb(rx_blob_id, rx_blob_total, rx_blob_offset, payload, payload_len, s_blob_ctx);
+    }
+    rx_blob_offset += payload_len;
+    if (rx_blob_offset == rx_blob_total) {
+        rx_blob_active = false;
+    }
+}
+
 void mcp_transport_receive(const uint8_t *data, size_t len) {
+    if (s_capture_fn) s_capture_fn(MCP_TRANSPORT_CAPTURE_RX, data, len, s_capture_ctx);
     if (!rx_buffer) return;
     if (len < 1) return;
 
@@ -175,11 +283,14 @@ void mcp_transport_receive(const uint8_t *data, size_t len) {
     const uint8_t *payload = data + 1;
     size_t payload_len = len - 1;
     
-    if (type == TYPE_SINGLE) {
+    if (type == TYPE_SINGLE && payload_len > 0 && payload[0] == BLOB_MARKER) {
+        mcp_transport_receive_blob(seq_id, payload, payload_len);
+    } else if (type == TYPE_SINGLE) {
         if (payload_len >= MAX_MESSAGE_SIZE) {
             mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Message too large");
             return;
         }
+        if (s_trace_fn) s_trace_fn(MCP_TRANSPORT_TRACE_RX_FIRST, payload_len, s_trace_ctx);
         memcpy(rx_buffer, payload, payload_len);
         rx_buffer[payload_len] = 0;
         mcp_transport_logf(MCP_TRANSPORT_LOG_INFO, "Received Single: %d bytes", (int)payload_len);
@@ -203,6 +314,7 @@ void mcp_transport_receive(const uint8_t *data, size_t len) {
             return;
         }
         
+        if (s_trace_fn) s_trace_fn(MCP_TRANSPORT_TRACE_RX_FIRST, rx_total_len, s_trace_ctx);
         rx_received_len = 0;
         rx_in_progress = true;
         rx_expect_seq_id = (uint8_t)((seq_id + 1) & HEADER_SEQ_MASK);
@@ -278,91 +390,180 @@ void mcp_transport_receive(const uint8_t *data, size_t len) {
     }
 }
 
-void mcp_transport_send_message(const char *json_message) {
+/* Lays out the header of the next packet and how far it may be filled. */
+static void mcp_transport_stream_start_packet(void) {
+    size_t remaining = s_stream_total - s_stream_offset;
+    size_t header_len;
+    size_t capacity;
+
+    if (s_stream_blob) {
+        if (s_stream_offset > 0 && s_tx_gap_ticks > 0 && s_sleep_fn) {
+            s_sleep_fn(s_tx_gap_ticks, s_sleep_ctx);
+        }
+        tx_buffer[0] = TYPE_SINGLE | (s_stream_seq & HEADER_SEQ_MASK);
+        tx_buffer[1] = BLOB_MARKER;
+        tx_buffer[2] = s_stream_offset == 0 ? BLOB_FLAG_FIRST : 0;
+        tx_buffer[3] = (s_stream_blob_id >> 8) & 0xFF;
+        tx_buffer[4] = s_stream_blob_id & 0xFF;
+        header_len = BLOB_HEADER_LEN;
+        if (s_stream_offset == 0) {
+            tx_buffer[5] = (s_stream_total >> 24) & 0xFF;
+            tx_buffer[6] = (s_stream_total >> 16) & 0xFF;
+            tx_buffer[7] = (s_stream_total >> 8) & 0xFF;
+            tx_buffer[8] = s_stream_total & 0xFF;
+            header_len += 4;
+        }
+        capacity = s_stream_packet_max - header_len;
+        if (capacity > remaining) {
+            capacity = remaining;
+        }
+    } else if (s_stream_offset == 0 && s_stream_total + 1 <= s_stream_packet_max) {
+        tx_buffer[0] = TYPE_SINGLE | (s_stream_seq & HEADER_SEQ_MASK);
+        header_len = 1;
+        capacity = remaining;
+    } else if (s_stream_offset == 0) {
+        tx_buffer[0] = TYPE_START | (s_stream_seq & HEADER_SEQ_MASK);
+        tx_buffer[1] = (s_stream_total >> 24) & 0xFF;
+        tx_buffer[2] = (s_stream_total >> 16) & 0xFF;
+        tx_buffer[3] = (s_stream_total >> 8) & 0xFF;
+        tx_buffer[4] = s_stream_total & 0xFF;
+        header_len = 5;
+        capacity = s_stream_packet_max - 5;
+    } else {
+        if (s_tx_gap_ticks > 0 && s_sleep_fn) {
+            s_sleep_fn(s_tx_gap_ticks, s_sleep_ctx);
+        }
+        header_len = 1;
+        if (remaining > (s_stream_packet_max - 1)) {
+            tx_buffer[0] = TYPE_CONT | (s_stream_seq & HEADER_SEQ_MASK);
+            capacity = s_stream_packet_max - 1;
+        } else {
+            tx_buffer[0] = TYPE_END | (s_stream_seq & HEADER_SEQ_MASK);
+            capacity = remaining;
+        }
+    }
+    s_stream_fill = header_len;
+    s_stream_packet_end = header_len + capacity;
+}
+
+static void mcp_transport_stream_flush(void) {
+    if (!mcp_transport_send_packet(tx_buffer, s_stream_fill)) {
+        mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Send failed");
+        s_stream_failed = true;
+        return;
+    }
+    s_stream_seq++;
+    if (s_stream_offset < s_stream_total) {
+        mcp_transport_stream_start_packet();
+    }
+}
+
+static bool mcp_transport_begin(size_t total_len, bool blob, uint16_t blob_id) {
     if (!s_send_fn || !tx_buffer) {
         mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Transport not ready");
-        return;
+        return false;
     }
 
     if (s_lock_fn) {
         s_lock_fn(true, s_lock_ctx);
     }
 
-    size_t total_len = strlen(json_message);
-    if (total_len > MAX_MESSAGE_SIZE) {
-        mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Message too large");
+    s_stream_packet_max = mcp_transport_max_packet_len();
+    if (blob ? s_stream_packet_max <= BLOB_HEADER_LEN + 4 || (uint64_t)total_len > UINT32_MAX
+             : total_len + 1 > s_stream_packet_max && s_stream_packet_max <= 5) {
+        mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "MTU too small");
         if (s_lock_fn) s_lock_fn(false, s_lock_ctx);
-        return;
+        return false;
     }
 
-    size_t offset = 0;
-    uint8_t seq_id = 0;
-    
-    size_t packet_len_max = mcp_transport_max_packet_len();
+    if (s_trace_fn) s_trace_fn(MCP_TRANSPORT_TRACE_TX_BEGIN, total_len, s_trace_ctx);
+    s_stream_active = true;
+    s_stream_failed = false;
+    s_stream_total = total_len;
+    s_stream_offset = 0;
+    s_stream_seq = 0;
+    s_stream_blob = blob;
+    s_stream_blob_id = blob_id;
+    mcp_transport_stream_start_packet();
+    if (total_len == 0) {
+        mcp_transport_stream_flush();
+    }
+    return true;
+}
 
-    if (total_len + 1 <= packet_len_max) {
-        tx_buffer[0] = TYPE_SINGLE | (seq_id & HEADER_SEQ_MASK);
-        memcpy(tx_buffer + 1, json_message, total_len);
-        if (!mcp_transport_send_packet(tx_buffer, total_len + 1)) {
-            mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Send failed");
-        }
-    } else {
-        if (packet_len_max <= 5) {
-            mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "MTU too small");
-            if (s_lock_fn) s_lock_fn(false, s_lock_ctx);
-            return;
-        }
+bool mcp_transport_stream_begin(size_t total_len) {
+    return mcp_transport_begin(total_len, false, 0);
+}
 
-        size_t chunk_len = packet_len_max - 5;
+bool mcp_transport_blob_begin(uint16_t blob_id, size_t total_len) {
+    return mcp_transport_begin(total_len, true, blob_id);
+}
 
-        tx_buffer[0] = TYPE_START | (seq_id & HEADER_SEQ_MASK);
-        tx_buffer[1] = (total_len >> 24) & 0xFF;
-        tx_buffer[2] = (total_len >> 16) & 0xFF;
-        tx_buffer[3] = (total_len >> 8) & 0xFF;
-        tx_buffer[4] = total_len & 0xFF;
+bool mcp_transport_stream_write(const uint8_t *data, size_t len) {
+    if (!s_stream_active || s_stream_failed) {
+        return false;
+    }
+    if (len > s_stream_total - s_stream_offset) {
+        mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Overflow");
+        s_stream_failed = true;
+        return false;
+    }
 
-        memcpy(tx_buffer + 5, json_message + offset, chunk_len);
-        if (!mcp_transport_send_packet(tx_buffer, chunk_len + 5)) {
-            mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Send failed");
-            if (s_lock_fn) s_lock_fn(false, s_lock_ctx);
-            return;
+    while (len > 0 && !s_stream_failed) {
+        size_t space = s_stream_packet_end - s_stream_fill;
+        size_t n = len < space ? len : space;
+        memcpy(tx_buffer + s_stream_fill, data, n);
+        s_stream_fill += n;
+        s_stream_offset += n;
+        data += n;
+        len -= n;
+        if (s_stream_fill == s_stream_packet_end) {
+            mcp_transport_stream_flush();
         }
+    }
+    return !s_stream_failed;
+}
 
-        offset += chunk_len;
-        seq_id++;
-        
-        while (offset < total_len) {
-            if (s_tx_gap_ticks > 0 && s_sleep_fn) {
-                s_sleep_fn(s_tx_gap_ticks, s_sleep_ctx);
-            }
-
-            size_t remaining = total_len - offset;
-            if (remaining > (packet_len_max - 1)) {
-                chunk_len = packet_len_max - 1;
-                tx_buffer[0] = TYPE_CONT | (seq_id & HEADER_SEQ_MASK);
-                memcpy(tx_buffer + 1, json_message + offset, chunk_len);
-                if (!mcp_transport_send_packet(tx_buffer, chunk_len + 1)) {
-                    mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Send failed");
-                    if (s_lock_fn) s_lock_fn(false, s_lock_ctx);
-                    return;
-                }
-                offset += chunk_len;
-                seq_id++;
-            } else {
-                chunk_len = remaining;
-                tx_buffer[0] = TYPE_END | (seq_id & HEADER_SEQ_MASK);
-                memcpy(tx_buffer + 1, json_message + offset, chunk_len);
-                if (!mcp_transport_send_packet(tx_buffer, chunk_len + 1)) {
-                    mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Send failed");
-                    if (s_lock_fn) s_lock_fn(false, s_lock_ctx);
-                    return;
-                }
-                offset += chunk_len;
-            }
-        }
+bool mcp_transport_stream_end(void) {
+    if (!s_stream_active) {
+        return false;
     }
+    bool ok = !s_stream_failed;
+    if (ok && s_stream_offset != s_stream_total) {
+        mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Length mismatch: exp %d, got %d", (int)s_stream_total,
+                           (int)s_stream_offset);
+        ok = false;
+    }
+    s_stream_active = false;
+    if (s_trace_fn) s_trace_fn(MCP_TRANSPORT_TRACE_TX_END, ok ? 1 : 0, s_trace_ctx);
+    if (s_lock_fn) {
+        s_lock_fn(false, s_lock_ctx);
+    }
+    return ok;
+}
 
+void mcp_transport_stream_abort(void) {
+    if (!s_stream_active) {
+        return;
+    }
+    mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Stream aborted at %d of %d", (int)s_stream_offset,
+                       (int)s_stream_total);
+    s_stream_active = false;
+    if (s_trace_fn) s_trace_fn(MCP_TRANSPORT_TRACE_TX_END, 0, s_trace_ctx);
     if (s_lock_fn) {
         s_lock_fn(false, s_lock_ctx);
     }
 }
+
+bool mcp_transport_send_message(const char *json_message) {
+    size_t total_len = strlen(json_message);
+    if (total_len > MAX_MESSAGE_SIZE) {
+        mcp_transport_logf(MCP_TRANSPORT_LOG_ERROR, "Message too large");
+        return false;
+    }
+    if (!mcp_transport_stream_begin(total_len)) {
+        return false;
+    }
+    mcp_transport_stream_write((const uint8_t *)json_message, total_len);
+    return mcp_transport_stream_end();
+}